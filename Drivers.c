@@ -0,0 +1,1658 @@
+/*
+ * Drivers.c
+ *
+ * Drivers of the devices of the board (see Drivers.h).
+ */
+
+#include "Drivers.h"
+
+/*--------------------------------------------------
+                 XBEE (API MODE)
+--------------------------------------------------*/
+bool XBeeApi = false;
+uint8_t XBeeDest[8] = {0,0,0,0,0,0,0,0};
+uint8_t XBeeFrameId = 0;
+uint8_t XBeeTx[XBEE_MAX_PAYLOAD];
+int XBeeTxLen = 0;
+uint8_t XBeeRx[XBEE_RX_BUFFER_SIZE];
+uint8_t XBeeRxHead = 0;
+uint8_t XBeeRxTail = 0;
+uint8_t XBeeFrame[XBEE_FRAME_MAX];
+int XBeeFrameLen = -3;
+int XBeeFrameSize = 0;
+bool XBeeEscaped = false;
+uint8_t XBeeAtFrameId = 0;
+int XBeeAtStatus = 0;
+
+int XBeeWriteEscaped(uint8_t byte)
+{
+	if(byte == XBEE_START || byte == XBEE_ESCAPE || byte == XBEE_XON || byte == XBEE_XOFF){
+		int error = USART1_WRITE(XBEE_ESCAPE);
+		if(error) return error;
+		byte ^= 0x20;
+	}
+	return USART1_WRITE(byte);
+}
+int XBeeSendFrame(uint8_t * header, int header_len, uint8_t * data, int len)
+{
+	// Send an API frame made of header + data
+	int error = USART1_WRITE(XBEE_START);
+	if(error) return error;
+	
+	int size = header_len + len;
+	error = XBeeWriteEscaped(size >> 8);
+	if(error) return error;
+	error = XBeeWriteEscaped(size);
+	if(error) return error;
+	
+	uint8_t sum = 0;
+	for(int II = 0; II < header_len; II++){
+		sum += header[II];
+		error = XBeeWriteEscaped(header[II]);
+		if(error) return error;
+	}
+	for(int II = 0; II < len; II++){
+		sum += data[II];
+		error = XBeeWriteEscaped(data[II]);
+		if(error) return error;
+	}
+	
+	return XBeeWriteEscaped(0xFF - sum);
+}
+void XBeeParseFrame(void)
+{
+	// Use a complete API frame (checksum already checked)
+	if(XBeeFrame[0] == XBEE_RX_PACKET && XBeeFrameSize >= 12){
+		// Source (64 bits) | source (16 bits) | options | RF data
+		for(int II = 0; II < 8; II++) XBeeDest[II] = XBeeFrame[1 + II];
+		for(int II = 12; II < XBeeFrameSize; II++){
+			uint8_t next = (XBeeRxHead + 1) & (XBEE_RX_BUFFER_SIZE - 1);
+			if(next == XBeeRxTail){
+				SetRegister(memory_XBEE_RX_ERRORS, REGISTER[memory_XBEE_RX_ERRORS] + 1); // Buffer full
+				break;
+			}
+			XBeeRx[XBeeRxHead] = XBeeFrame[II];
+			XBeeRxHead = next;
+		}
+	}
+	else if(XBeeFrame[0] == XBEE_TX_STATUS && XBeeFrameSize >= 7){
+		// Frame id | destination (16 bits) | retries | delivery status | discovery status
+		if(XBeeFrame[5]){
+			SetRegister(memory_XBEE_TX_FAILS, REGISTER[memory_XBEE_TX_FAILS] + 1);
+			SaveError(XBEE_TX_FAILED, XBeeFrame[1], XBeeFrame[5]);
+		}
+	}
+	else if(XBeeFrame[0] == XBEE_AT_RESPONSE && XBeeFrameSize >= 5){
+		// Frame id | AT command (2) | status | data
+		XBeeAtFrameId = XBeeFrame[1];
+		XBeeAtStatus = XBeeFrame[4];
+	}
+}
+void XBEE_POLL(void)
+{
+	// Receive the API frames from the bytes waiting on USART1 (without waiting)
+	char temp;
+	while(USART1_FLAG())
+	{
+		if(USART1_READ(&temp, 0)){
+			// Reception error: drop the frame
+			XBeeFrameLen = -3;
+			SetRegister(memory_XBEE_RX_ERRORS, REGISTER[memory_XBEE_RX_ERRORS] + 1);
+			continue;
+		}
+		uint8_t byte = temp;
+		
+		// A start delimiter always starts a new frame
+		if(byte == XBEE_START){
+			XBeeFrameLen = -2;
+			XBeeEscaped = false;
+			continue;
+		}
+		if(XBeeFrameLen == -3) continue;
+		if(byte == XBEE_ESCAPE){
+			XBeeEscaped = true;
+			continue;
+		}
+		if(XBeeEscaped){
+			byte ^= 0x20;
+			XBeeEscaped = false;
+		}
+		
+		if(XBeeFrameLen == -2){
+			XBeeFrameSize = byte << 8;
+			XBeeFrameLen++;
+		}
+		else if(XBeeFrameLen == -1){
+			XBeeFrameSize |= byte;
+			XBeeFrameLen++;
+			if(XBeeFrameSize == 0 || XBeeFrameSize > XBEE_FRAME_MAX) XBeeFrameLen = -3; // Not for us
+		}
+		else if(XBeeFrameLen < XBeeFrameSize){
+			XBeeFrame[XBeeFrameLen++] = byte;
+		}
+		else{
+			// Checksum: the sum of the frame data and the checksum is 0xFF
+			uint8_t sum = byte;
+			for(int II = 0; II < XBeeFrameSize; II++) sum += XBeeFrame[II];
+			if(sum == 0xFF) XBeeParseFrame();
+			else SetRegister(memory_XBEE_RX_ERRORS, REGISTER[memory_XBEE_RX_ERRORS] + 1);
+			XBeeFrameLen = -3;
+		}
+	}
+}
+int XBeeAtCommand(const char * command, uint8_t * parameter, int len)
+{
+	// Send an AT command and wait for its response
+	if(!XBeeApi) return XBEE_NOT_API;
+	
+	if(++XBeeFrameId == 0) XBeeFrameId = 1; // 0 = no response
+	uint8_t header[4] = {XBEE_AT_COMMAND, XBeeFrameId, command[0], command[1]};
+	int error = XBeeSendFrame(header, 4, parameter, len);
+	if(error) return error;
+	
+	uint32_t start = GetTicks();
+	while(XBeeAtFrameId != XBeeFrameId){
+		XBEE_POLL();
+		if(GetTicks() - start > XBEE_AT_TIMEOUT_MS) return XBEE_TIMEOUT;
+	}
+	
+	if(XBeeAtStatus) return XBEE_AT_ERROR;
+	return OK;
+}
+int XBEE_SEND(void)
+{
+	// Send the bytes written since the last packet in one RF packet (API mode only)
+	if(!XBeeApi || XBeeTxLen == 0) return OK;
+	
+	if(++XBeeFrameId == 0) XBeeFrameId = 1; // 0 = no transmit status
+	uint8_t header[14] = {XBEE_TX_REQUEST, XBeeFrameId, 0,0,0,0,0,0,0,0, 0xFF, 0xFE, 0, 0}; // 16-bit address unknown, max radius, no option
+	for(int II = 0; II < 8; II++) header[2 + II] = XBeeDest[II];
+	
+	int error = XBeeSendFrame(header, 14, XBeeTx, XBeeTxLen);
+	XBeeTxLen = 0;
+	return error;
+}
+int XBEE_WRITE(char var)
+{
+	if(!XBeeApi) return USART1_WRITE(var);
+	
+	// Packet full: send it
+	if(XBeeTxLen == XBEE_MAX_PAYLOAD){
+		int error = XBEE_SEND();
+		if(error) return error;
+	}
+	XBeeTx[XBeeTxLen++] = var;
+	return OK;
+}
+bool XBEE_FLAG(void)
+{
+	if(!XBeeApi) return USART1_FLAG();
+	
+	XBEE_POLL();
+	return XBeeRxHead != XBeeRxTail;
+}
+int XBEE_READ(char * var, long timeout_ms)
+{
+	if(!XBeeApi) return USART1_READ(var, timeout_ms);
+	
+	uint32_t start = GetTicks();
+	while(!XBEE_FLAG()){
+		if(GetTicks() - start >= (uint32_t)timeout_ms) return XBEE_TIMEOUT;
+		CheckWatchdogSave(); // Blocking wait (see Memory.h)
+	}
+	
+	*var = XBeeRx[XBeeRxTail];
+	XBeeRxTail = (XBeeRxTail + 1) & (XBEE_RX_BUFFER_SIZE - 1);
+	return OK;
+}
+void XBEE_FLUSH(void)
+{
+	if(!XBeeApi){
+		USART1_FLUSH();
+		return;
+	}
+	
+	XBEE_POLL();
+	XBeeRxTail = XBeeRxHead;
+}
+int XBeeSetBaud(unsigned long baud)
+{
+	// Change the baud rate of the radio, then of USART1
+	const unsigned long rates[9] = {1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400};
+	int index = -1;
+	for(int II = 0; II < 9; II++) if(rates[II] == baud) index = II;
+	if(index < 0 && baud < XBEE_BD_RATE_MIN) return XBEE_BAUD_OOB;
+	
+	// Check that USART1 can use it before changing the radio
+	struct usart_setting setting;
+	if(!GetBaudSetting(baud, &setting)) return UART1_BAUD_ERROR;
+	
+	// Index of a standard rate, or the rate itself (MSB first)
+	uint8_t parameter[4] = {baud >> 24, baud >> 16, baud >> 8, baud};
+	int error = (index >= 0) ? XBeeAtCommand("BD", (uint8_t [1]){index}, 1) : XBeeAtCommand("BD", parameter, 4);
+	if(error) return error;
+	error = XBeeAtCommand("AC", NULL, 0); // Apply changes (the response is sent at the old rate)
+	if(error) return error;
+	
+	return USART1_INIT(baud);
+}
+int XBeeSetPacketTimeout(uint8_t character_times)
+{
+	// Number of character times of silence before the radio sends the received bytes (RO)
+	uint8_t parameter[1] = {character_times};
+	int error = XBeeAtCommand("RO", parameter, 1);
+	if(error) return error;
+	error = XBeeAtCommand("AC", NULL, 0);
+	if(error) return error;
+	
+	SetRegister(memory_XBEE_RO, character_times);
+	return OK;
+}
+int XBEE_INIT(bool api, unsigned long baud)
+{
+	XBeeApi = api;
+	XBeeTxLen = 0;
+	XBeeRxHead = XBeeRxTail = 0;
+	XBeeFrameLen = -3;
+	
+	SetRegister(memory_XBEE_API, api);
+	SetRegister(memory_XBEE_TX_FAILS, 0);
+	SetRegister(memory_XBEE_RX_ERRORS, 0);
+	
+	if(!api) return USART1_INIT(baud);
+	if(baud == REGISTER[memory_USART1_BAUD]) return OK;
+	return XBeeSetBaud(baud);
+}
+
+/*--------------------------------------------------
+              COMMUNICATION (XBEE & USB)
+--------------------------------------------------*/
+unsigned char Message[FrameMaxN];
+int MessageLength = MessageN;
+unsigned char Feedback[MessageN];
+uint8_t FrameBuffer[FrameMaxN + 2 + 2 + (FrameMaxN + 2)/254];
+uint16_t MessageSeq = 0;
+struct replay_entry ReplayCache[2][ReplayCacheN];
+int ReplayNext[2];
+struct replay_batch ReplayBatch[2];
+int ResponseFrames;
+int ResponseCommand;
+long ResponseData;
+int CommandStatus;
+uint8_t * BatchReply = NULL;
+uint32_t CommandReadyUs;
+uint16_t LatencyHistogram[LATENCY_CLASSES][LATENCY_BUCKETS];
+struct rx_port RxPort[2];
+int ServedPort = 2;
+
+void ResetLatency(int latency_class)
+{
+	// Clear the histogram of a class (LATENCY_CLASSES = all)
+	for(int II = 0; II < LATENCY_CLASSES; II++){
+		if(latency_class != LATENCY_CLASSES && latency_class != II) continue;
+		for(int JJ = 0; JJ < LATENCY_BUCKETS; JJ++) LatencyHistogram[II][JJ] = 0;
+	}
+}
+int COMMUNICATION_INIT(long timeout_ms)
+{
+	// The XBee is initialized by XBEE_INIT
+	
+	// Initialize register
+	SetRegister(memory_MESSAGE_COUNT0, 0);
+	SetRegister(memory_FEEDBACK_COUNT0, 0);
+	SetRegister(memory_MESSAGE_COUNT1, 0);
+	SetRegister(memory_FEEDBACK_COUNT1, 0);
+	
+	SetRegister(memory_COMMUNICATION_TIMEOUT, timeout_ms);
+	
+	SetRegister(memory_FRAMING0, FRAMING_LEGACY);
+	SetRegister(memory_FRAMING1, FRAMING_LEGACY);
+	SetRegister(memory_FRAME_ERRORS0, 0);
+	SetRegister(memory_FRAME_ERRORS1, 0);
+	SetRegister(memory_REPLAYS0, 0);
+	SetRegister(memory_REPLAYS1, 0);
+	SetRegister(memory_RX_LATENCY0, 0);
+	SetRegister(memory_RX_LATENCY1, 0);
+	SetRegister(memory_RX_LATENCY_MAX0, 0);
+	SetRegister(memory_RX_LATENCY_MAX1, 0);
+	SetRegister(memory_COMMAND_LATENCY, 0);
+	SetRegister(memory_COMMAND_LATENCY_MAX, 0);
+	ResetLatency(LATENCY_CLASSES);
+	
+	return OK;
+}
+bool IsFramed(int port)
+{
+	if(port!=1 && port!=2) return false;
+	return REGISTER[memory_FRAMING0 + port - 1] == FRAMING_COBS;
+}
+int ReadByte(int port, char * var, long timeout_ms)
+{
+	if(port==1) return USART0_READ(var, timeout_ms);
+	if(port==2) return XBEE_READ(var, timeout_ms);
+	return COMMUNICATION_READ_PORT;
+}
+int WriteByte(int port, char var)
+{
+	if(port==1) return USART0_WRITE(var);
+	if(port==2) return XBEE_WRITE(var);
+	return COMMUNICATION_WRITE_PORT;
+}
+int CobsEncode(const uint8_t * input, int len, uint8_t * output)
+{
+	// Replace the zeros by the distance to the next zero. Return the length of the encoded bytes (without delimiter)
+	int code_index = 0;
+	int out_len = 1;
+	uint8_t code = 1;
+	
+	for (int II = 0; II < len; II++)
+	{
+		if(input[II] == 0){
+			output[code_index] = code;
+			code_index = out_len++;
+			code = 1;
+		}
+		else{
+			output[out_len++] = input[II];
+			if(++code == 0xFF){
+				output[code_index] = code;
+				code_index = out_len++;
+				code = 1;
+			}
+		}
+	}
+	output[code_index] = code;
+	
+	return out_len;
+}
+int CobsDecode(uint8_t * buffer, int len)
+{
+	// Decode in place. Return the length of the decoded bytes, or -1 if the frame is malformed
+	int in = 0;
+	int out = 0;
+	
+	while(in < len)
+	{
+		uint8_t code = buffer[in++];
+		if(code == 0 || in + code - 1 > len) return -1;
+		
+		for (int II = 1; II < code; II++) buffer[out++] = buffer[in++];
+		if(code != 0xFF && in < len) buffer[out++] = 0;
+	}
+	
+	return out;
+}
+int SendFrame(int port, uint8_t * payload, int len)
+{
+	// Send a COBS frame: payload + CRC-16 (MSB first) + delimiter
+	if(len > FrameMaxN) return COMMUNICATION_FRAME_LENGTH;
+	
+	uint8_t frame[FrameMaxN + 2];
+	for (int II = 0; II < len; II++) frame[II] = payload[II];
+	uint16_t crc = Crc16(0xFFFF, payload, len);
+	frame[len] = crc >> 8;
+	frame[len + 1] = crc;
+	
+	int error;
+	int n = CobsEncode(frame, len + 2, FrameBuffer);
+	for (int II = 0; II < n; II++)
+	{
+		error = WriteByte(port, FrameBuffer[II]);
+		if(error) return error;
+	}
+	
+	error = WriteByte(port, FrameDelimiter);
+	if(error) return error;
+	
+	return (port==2) ? XBEE_SEND() : OK;
+}
+int CheckFrame(int port, uint8_t * raw, int raw_len, bool overflow, uint8_t * payload, int max_len, int * len)
+{
+	// Decode a COBS frame (in place) and check its length and CRC-16
+	int error = OK;
+	int n = CobsDecode(raw, raw_len) - 2;
+	if(overflow || n > max_len) error = COMMUNICATION_FRAME_LENGTH;
+	else if(n < 0 || Crc16(0xFFFF, raw, n) != (((uint16_t)raw[n] << 8) | raw[n + 1])) error = COMMUNICATION_CHECKSUM;
+	if(error){
+		SetRegister(memory_FRAME_ERRORS0 + port - 1, REGISTER[memory_FRAME_ERRORS0 + port - 1] + 1);
+		return error;
+	}
+	
+	for (int II = 0; II < n; II++) payload[II] = raw[II];
+	*len = n;
+	
+	return OK;
+}
+int ReceiveFrame(int port, uint8_t * payload, int max_len, int * len, long timeout_ms)
+{
+	// Receive a COBS frame up to the next delimiter, and check its CRC-16
+	int error;
+	char temp;
+	int raw = 0;
+	bool overflow = false;
+	
+	// Skip the delimiters between frames
+	do{
+		error = ReadByte(port, &temp, timeout_ms);
+		if(error) return error;
+	}while(temp == FrameDelimiter);
+	
+	// Read up to the delimiter (the bytes of a too long frame are dropped)
+	while(temp != FrameDelimiter)
+	{
+		if(raw < (int)sizeof(FrameBuffer)) FrameBuffer[raw++] = temp;
+		else overflow = true;
+		
+		error = ReadByte(port, &temp, timeout_ms);
+		if(error) return error;
+	}
+	
+	return CheckFrame(port, FrameBuffer, raw, overflow, payload, max_len, len);
+}
+int ReceivePoll(int port)
+{
+	// Move the bytes received on the port into its message, without waiting
+	struct rx_port * rx = &RxPort[port - 1];
+	bool framed = IsFramed(port);
+	char temp;
+	
+	while(rx->state != RX_READY && (port == 1 ? USART0_FLAG() : XBEE_FLAG()))
+	{
+		int error = ReadByte(port, &temp, 0);
+		if(error){
+			// Drop the message
+			rx->state = RX_IDLE;
+			rx->len = 0;
+			rx->overflow = false;
+			return error;
+		}
+		rx->last_tick = GetTicks();
+		
+		if(framed && temp == FrameDelimiter){
+			if(rx->len || rx->overflow) rx->state = RX_READY; // Empty frames are skipped
+		}
+		else{
+			if(rx->len < (int)sizeof(rx->buffer)) rx->buffer[rx->len++] = temp;
+			else rx->overflow = true;
+			rx->state = RX_RECEIVING;
+			if(!framed && rx->len == MessageN) rx->state = RX_READY;
+		}
+		
+		if(rx->state == RX_READY) rx->ready_us = GetMicros();
+	}
+	
+	// Drop a partial message after the timeout
+	if(rx->state == RX_RECEIVING && GetTicks() - rx->last_tick > (uint32_t)REGISTER[memory_COMMUNICATION_TIMEOUT]){
+		rx->state = RX_IDLE;
+		rx->len = 0;
+		rx->overflow = false;
+		return (port == 1) ? UART0_TIMEOUT : UART1_TIMEOUT;
+	}
+	
+	return OK;
+}
+int IsCommandWaiting(void)
+{
+	// Receive on both ports, then serve the complete messages in turn
+	int error = ReceivePoll(1); // USB
+	if(error) SaveError(error, 0, 1);
+	error = ReceivePoll(2); // XBee
+	if(error) SaveError(error, 0, 2);
+	
+	int first = (ServedPort == 1) ? 2 : 1; // The port served last waits
+	if(RxPort[first - 1].state == RX_READY) return first;
+	if(RxPort[2 - first].state == RX_READY) return 3 - first;
+	return 0;
+}
+int LoadMessage(int port, uint8_t * buffer, int len, long timeout_ms)
+{
+	int error;
+	
+	//The message byte
+	char temp;
+	
+	if(IsFramed(port)){		// COBS frame of exactly len bytes
+		int received;
+		error = ReceiveFrame(port, buffer, len, &received, timeout_ms);
+		if(error) return error;
+		if(received != len) return COMMUNICATION_FRAME_LENGTH;
+	}
+	else if(port==1){			// USB
+		//Loop over the number of bytes to be received
+		for (int II = 0; II < len; II++)
+		{
+			error = USART0_READ(&temp, timeout_ms);
+			if(error) {USART0_FLUSH(); return error;}
+
+			buffer[II] = temp;
+		}
+		
+		// Flush the rest to clear the buffers
+		USART0_FLUSH();
+	}
+	else if (port==2){		// XBee
+		//Loop over the number of bytes to be received
+		for (int II = 0; II < len; II++)
+		{
+			error = XBEE_READ(&temp, timeout_ms);
+			if(error) {XBEE_FLUSH(); return error;}
+
+			buffer[II] = temp;
+		}
+		
+		// Flush the rest to clear the buffers
+		XBEE_FLUSH();
+	}
+	else return COMMUNICATION_READ_PORT;
+	SetRegister(memory_MESSAGE_COUNT0 + port -1, REGISTER[memory_MESSAGE_COUNT0 + port -1] + 1);
+	
+	return OK;
+}
+int SaveCommand(int port)
+{
+	// Take the complete message of the port (see IsCommandWaiting)
+	if(port!=1 && port!=2) return COMMUNICATION_READ_PORT;
+	struct rx_port * rx = &RxPort[port - 1];
+	if(rx->state != RX_READY) return COMMUNICATION_READ_PORT;
+	
+	// Queue latency
+	uint32_t latency = GetMicros() - rx->ready_us;
+	SetRegister(memory_RX_LATENCY0 + port - 1, latency);
+	if(latency > (uint32_t)REGISTER[memory_RX_LATENCY_MAX0 + port - 1]) SetRegister(memory_RX_LATENCY_MAX0 + port - 1, latency);
+	CommandReadyUs = rx->ready_us;
+	ServedPort = port;
+	
+	int error = OK;
+	MessageSeq = 0;
+	ResponseFrames = 0;
+	if(IsFramed(port)){
+		// Variable length: command + data + optional bytes
+		error = CheckFrame(port, rx->buffer, rx->len, rx->overflow, Message, FrameMaxN, &MessageLength);
+		if(!error && MessageLength < MessageCommandN + MessageDataN) error = COMMUNICATION_FRAME_LENGTH;
+		if(!error && MessageLength >= MessageCommandN + MessageDataN + MessageSeqN) MessageSeq = ((uint16_t)Message[MessageCommandN + MessageDataN] << 8) | Message[MessageCommandN + MessageDataN + 1];
+	}
+	else{
+		for (int II = 0; II < MessageN; II++) Message[II] = rx->buffer[II];
+		MessageLength = MessageN;
+	}
+	
+	// Ready for the next message
+	rx->state = RX_IDLE;
+	rx->len = 0;
+	rx->overflow = false;
+	if(error) return error;
+	
+	SetRegister(memory_MESSAGE_COUNT0 + port -1, REGISTER[memory_MESSAGE_COUNT0 + port -1] + 1);
+	return OK;
+}
+int SendFeedback(int port, int address, long data)
+{
+	int error;
+	int II;
+	unsigned int sum = 0;
+	
+	// In a batch, the feedback is kept for the aggregated reply
+	if(BatchReply)
+	{
+		for (II = 0; II < MessageCommandN; II++) BatchReply[II] = (unsigned char)(address >> 8*(MessageCommandN-II-1));
+		for (II = 0; II < MessageDataN; II++) BatchReply[MessageCommandN + II] = (unsigned char)(data >> 8*(MessageDataN-II-1));
+		return OK;
+	}
+
+	// Address
+	for (II = 0; II < MessageCommandN; II++)
+	{
+		sum += (address >> 8*(MessageCommandN-II-1)) & 0xff;
+		Feedback[II] = (unsigned char)(address >> 8*(MessageCommandN-II-1));
+	}
+	
+	// Data
+	for (II = 0; II < MessageDataN; II++)
+	{
+		sum += (data >> 8*(MessageDataN-II-1)) & 0xff;
+		Feedback[MessageCommandN + II] = (unsigned char)(data >> 8*(MessageDataN-II-1));
+	}
+
+	// Checksum
+	if(MessageChecksumN)
+	{
+		unsigned int mask = (1<<8*MessageChecksumN) - 1;
+		unsigned int checksum = mask - (sum & mask);
+		
+		for (II = 0; II < MessageChecksumN; II++)
+		{
+			Feedback[MessageCommandN + MessageDataN + II] = (unsigned char)(checksum >> 8*(MessageChecksumN-II-1));
+		}
+	}
+
+	
+	// Send
+	if (IsFramed(port)){
+		// Echo the sequence number of the message (if any)
+		uint8_t frame[MessageCommandN + MessageDataN + MessageSeqN];
+		int len = MessageCommandN + MessageDataN;
+		for(II = 0; II < len; II++) frame[II] = Feedback[II];
+		if(MessageSeq){
+			frame[len++] = MessageSeq >> 8;
+			frame[len++] = MessageSeq;
+		}
+		
+		error = SendFrame(port, frame, len);
+		if(error) return error;
+	}
+	else if (port==1){
+		for(II = 0; II < MessageN; II++)
+		{
+			error = USART0_WRITE(Feedback[II]);
+			if(error) return error;
+		}
+	}
+	else if (port==2){
+		for(II = 0; II < MessageN; II++)
+		{
+			error = XBEE_WRITE(Feedback[II]);
+			if(error) return error;
+		}
+		error = XBEE_SEND();
+		if(error) return error;
+	}
+	else return COMMUNICATION_WRITE_PORT;
+	SetRegister(memory_MESSAGE_COUNT0 + port - 1, REGISTER[memory_MESSAGE_COUNT0 + port - 1] + 1);
+	
+	// Keep the response for the replay cache
+	ResponseFrames++;
+	ResponseCommand = address;
+	ResponseData = data;
+
+	return OK;
+}
+int SendStatus(int port, int command, int status, long data)
+{
+	// Send the status of a command. Failed commands are logged in the error file
+	CommandStatus = status;
+	if(status) SaveError(status, command, data);
+	
+	return SendFeedback(port, command, status);
+}
+int SendBytes(int port, uint8_t * buffer, int len)
+{
+	// Send raw bytes (after a feedback announcing them). With COBS framing, they are sent in their own frame
+	ResponseFrames++;
+	if(IsFramed(port)) return SendFrame(port, buffer, len);
+	
+	for(int II = 0; II < len; II++)
+	{
+		int error = WriteByte(port, buffer[II]);
+		if(error) return error;
+	}
+	
+	return (port==2) ? XBEE_SEND() : OK;
+}
+int ReplayBatchResponse(int port)
+{
+	// Send again the reply of the last batch of the port (see ReplayResponse)
+	struct replay_batch * entry = &ReplayBatch[port - 1];
+	if(!entry->valid || entry->seq != MessageSeq) return 0;
+	if(entry->crc != Crc16(0xFFFF, Message, MessageLength)){
+		entry->valid = false; // Same sequence number for another batch: the old reply is obsolete
+		return 0;
+	}
+	
+	SetRegister(memory_REPLAYS0 + port - 1, REGISTER[memory_REPLAYS0 + port - 1] + 1);
+	int error = SendFeedback(port, 250, entry->executed);
+	if(!error) error = SendBytes(port, entry->reply, entry->executed*(MessageCommandN + MessageDataN));
+	if(error) SaveError(error, 250, MessageSeq);
+	return 1;
+}
+int ReplayResponse(int port)
+{
+	// Send again the feedback of a message already executed. Return 1 if replayed, 0 if the message must be executed
+	if(!IsFramed(port) || MessageSeq == 0) return 0;
+	if(Message[0] == 250) return ReplayBatchResponse(port);
+	
+	for(int II = 0; II < ReplayCacheN; II++)
+	{
+		struct replay_entry * entry = &ReplayCache[port - 1][II];
+		if(!entry->valid || entry->seq != MessageSeq) continue;
+		
+		int same = 1;
+		for(int JJ = 0; JJ < MessageCommandN + MessageDataN; JJ++) if(entry->message[JJ] != Message[JJ]) same = 0;
+		if(!same){
+			entry->valid = false; // Same sequence number for another message: the old response is obsolete
+			return 0;
+		}
+		
+		SetRegister(memory_REPLAYS0 + port - 1, REGISTER[memory_REPLAYS0 + port - 1] + 1);
+		int error = SendFeedback(port, entry->command, entry->data);
+		if(error) SaveError(error, entry->command, MessageSeq);
+		return 1;
+	}
+	
+	return 0;
+}
+int LatencyClass(unsigned int command)
+{
+	if(command <= 150) return LATENCY_REGISTER;
+	if(command <= 160) return LATENCY_INTERFACES;
+	if(command <= 172) return LATENCY_POWER;
+	if(command >= 175 && command <= 177) return LATENCY_SEPARATION;
+	if(command >= 179 && command <= 206) return LATENCY_PICOMOTOR;
+	if(command >= 210 && command <= 214) return LATENCY_ELECTRODE;
+	if(command >= 220 && command <= 222) return LATENCY_TEMPERATURE;
+	if(command >= 240 && command <= 249) return LATENCY_MEMORY;
+	if(command == 250) return LATENCY_BATCH;
+	return LATENCY_OTHER;
+}
+void RecordLatency(void)
+{
+	// The response of the message just executed is sent
+	uint32_t latency = GetMicros() - CommandReadyUs;
+	SetRegister(memory_COMMAND_LATENCY, latency);
+	if(latency > (uint32_t)REGISTER[memory_COMMAND_LATENCY_MAX]) SetRegister(memory_COMMAND_LATENCY_MAX, latency);
+	
+	int bucket = 0;
+	for(uint32_t us = latency >> 7; us && bucket < LATENCY_BUCKETS - 1; us >>= 1) bucket++;
+	
+	uint16_t * count = &LatencyHistogram[LatencyClass(Message[0])][bucket];
+	if(*count < UINT16_MAX) (*count)++;
+}
+int ReadLatency(int latency_class, uint8_t * buffer)
+{
+	// Histogram of a class (LATENCY_BUCKETS counts of 2 bytes, MSB first). Returns the number of bytes
+	for(int II = 0; II < LATENCY_BUCKETS; II++){
+		buffer[2*II] = LatencyHistogram[latency_class][II] >> 8;
+		buffer[2*II + 1] = LatencyHistogram[latency_class][II];
+	}
+	return 2*LATENCY_BUCKETS;
+}
+void CacheResponse(int port)
+{
+	// Keep the response of the message just executed (single feedback only)
+	if(!IsFramed(port) || MessageSeq == 0 || ResponseFrames != 1) return;
+	
+	struct replay_entry * entry = &ReplayCache[port - 1][ReplayNext[port - 1]];
+	ReplayNext[port - 1] = (ReplayNext[port - 1] + 1) % ReplayCacheN;
+	
+	entry->valid = true;
+	entry->seq = MessageSeq;
+	for(int II = 0; II < MessageCommandN + MessageDataN; II++) entry->message[II] = Message[II];
+	entry->command = ResponseCommand;
+	entry->data = ResponseData;
+}
+void CacheBatchResponse(int port, int executed, const uint8_t * reply)
+{
+	// Keep the reply of the batch just executed, before it is sent (the commands are executed even if it is lost)
+	if(!IsFramed(port) || MessageSeq == 0) return;
+	
+	struct replay_batch * entry = &ReplayBatch[port - 1];
+	entry->valid = true;
+	entry->seq = MessageSeq;
+	entry->crc = Crc16(0xFFFF, Message, MessageLength);
+	entry->executed = executed;
+	for(int II = 0; II < executed*(MessageCommandN + MessageDataN); II++) entry->reply[II] = reply[II];
+}
+
+/*--------------------------------------------------
+                    POWER/HV BOARD
+--------------------------------------------------*/
+int POWER_INIT(void){	
+	// Set tolerance on ADC feedback
+	SetRegister(memory_HV_TOL_V, 31); // 0.1V tolerance over 3.3V max
+	
+	// Set step increment voltage
+	SetRegister(memory_HV_STEP, 337); // 10V steps
+	
+	// Set bias voltage
+	SetRegister(memory_HV_BIAS, 8191); // 8191 = +240V Bias
+	
+	// Set Supply voltage enable as output
+	DDR_SV |= ((1<<FIVE_V_E) | (1<<TWELVE_V_E) | (1<<TWO_EIGHT_V_E));
+	PORT_SV &= ~((1<<FIVE_V_E) | (1<<TWELVE_V_E) | (1<<TWO_EIGHT_V_E));
+	
+	// Disable Supply Voltages
+	int error;
+	error = EnableSV(TWELVE_V_E,false);
+	if(error) return error;
+	error = EnableSV(FIVE_V_E,false);
+	if(error) return error;
+	error = EnableSV(TWO_EIGHT_V_E,false);
+	if(error) return error;
+	
+	// Disable Current Limiters
+	error = EnableCL(CL1_E,false);
+	if(error) return error;
+	error = EnableCL(CL2_E,false);
+	if(error) return error;
+	error = EnableCL(CL3_E,false);
+	if(error) return error;
+	
+	// Set Current Limiters Enable as output
+	DDR_CL_E |= ((1<<CL1_E) | (1<<CL2_E) | (1<<CL3_E));
+	PORT_CL_E &= ~((1<<CL1_E) | (1<<CL2_E) | (1<<CL3_E));
+	
+	// Set Current Limiters Fault as inputs
+	DDR_CL_F1 &= ~((1<<CL2_F) | (1<<CL3_F));
+	DDR_CL_F2 &= ~(1<<CL1_F);
+	
+	return OK;
+}
+int ActivateHV(void)
+{
+	int error;
+	
+	// 1) Enable 5V
+	error = EnableSV(FIVE_V_E,true);
+	if(error) return error;
+	
+	// 2) Command variable HV to 0V
+	error = SetVoltage(10000);
+	if(error) return error;	
+	
+	// 3) Command ground to 0V
+	error = SetBias(0x3fff);
+	if(error) return error;
+	
+	// 4) Enable 12V
+	error = EnableSV(TWELVE_V_E,true);
+	if(error) return error;
+	
+	// 5) Enable CL3
+	error = EnableCL(CL3_E,true);
+	if(error) return error;
+	
+	// 6) Check HV_VOLTAGE at 2.5V
+	/*int val;
+	error = MeasureV(HV_VOLTAGE,&val);
+	if(error) return error;
+	if(abs(val-TWO_FIVE_V) > REGISTER[memory_HV_TOL_V]) {
+		// Disable CL3
+		error = EnableCL(CL3_E,false);
+		if(error) return error;
+		
+		return VAR_FEEDBACK_OOB;
+	}*/
+		
+	// 7) Check CL3
+	/*if(IsCLFault(3)){
+		// Disable CL3
+		error = EnableCL(CL3_E,false);
+		if(error) return error;
+		
+		return CL3_FAULT;
+	}*/
+	
+	// 8) Enable CL2
+	error = EnableCL(CL2_E,true);
+	if(error) return error;
+	
+	// 9) Check HV_GROUND at 2.5V
+	/*error = MeasureV(HV_GROUND,&val);
+	if(error) return error;
+	if(abs(val-TWO_FIVE_V) > REGISTER[memory_HV_TOL_V]) {
+		// Disable CL2
+		error = EnableCL(CL2_E,false);
+		if(error) return error;
+		
+		return GROUND_FEEDBACK_OOB;
+	}*/
+	
+	// 10) Check CL2 //TODO
+	/*if(IsCLFault(2)){
+		// Disable CL2
+		error = EnableCL(CL2_E,false);
+		if(error) return error;
+		
+		return CL2_FAULT;
+	}*/
+	
+	return OK;
+}
+int DeactivateHV(void){
+	int error;
+	
+	// 1) Command variable HV to BIAS
+	error = SetVoltage(REGISTER[memory_HV_BIAS]);
+	if(error) return error;
+	_delay_ms(REGISTER[memory_HV_TIMER]);
+	
+	// 2) Disable 12V
+	error = EnableSV(TWELVE_V_E,false);
+	if(error) return error;
+	
+	// 3) Disable CL3
+	error = EnableCL(CL3_E,false);
+	if(error) return error;
+	
+	// 4) Disable CL2
+	error = EnableCL(CL2_E,false);
+	if(error) return error;
+	
+	// 5) Disable 5V
+	error = EnableSV(FIVE_V_E,false);
+	if(error) return error;
+	
+	return OK;
+	
+}
+int ActivatePICOV(bool withEncoders){
+	int error;
+	
+	// 1) Enable 12V
+	error = EnableSV(TWELVE_V_E,true);
+	if(error) return error;
+	
+	// 2) Enable CL1
+	error = EnableCL(CL1_E,true);
+	if(error) return error;
+	
+	// 3) Check PICOMOTOR_VOLTAGE at 2.5V
+	/*int val;
+	error = MeasureV(PICOMOTOR_VOLTAGE,&val);
+	if(error) return error;
+	if(abs(val-TWO_FIVE_V) > REGISTER[memory_HV_TOL_V]) {
+		// Disable CL1
+		error = EnableCL(CL1_E,false);
+		if(error) return error;
+		
+		return PICOMOTOR_FEEDBACK_OOB;
+	}*/
+		
+	// 4) Check CL1
+	/*if(IsCLFault(1)){
+		// Disable CL1
+		error = EnableCL(CL1_E,false);
+		if(error) return error;
+		
+		return CL1_FAULT;
+	}*/
+
+	if(withEncoders){
+		// 5) Enable 2.8V
+		error = EnableSV(TWO_EIGHT_V_E,true);
+		if(error) return error;
+	}
+	
+	return OK;
+}
+int DeactivatePICOV(void){
+	int error;
+	
+	// 1) Disable 12V
+	error = EnableSV(TWELVE_V_E,false);
+	if(error) return error;
+	
+	// 2) Disable CL1
+	error = EnableCL(CL1_E,false);
+	if(error) return error;
+	
+	// 5) Disable 2.8V
+	error = EnableSV(TWO_EIGHT_V_E,false);
+	if(error) return error;
+	
+	return OK;
+}
+int SetVoltage(uint16_t voltage)
+{
+	int error = SPI_WRITE(SELECT_HV,(uint8_t [2]){voltage>>8, voltage},2);
+	if(error) return error;
+	
+	SetRegister(memory_HV, voltage);
+	return OK;
+}
+int SetBias(uint16_t voltage){
+	int error = SPI_WRITE(SELECT_BIAS,(uint8_t [2]){voltage>>8, voltage},2);
+	if(error) return error;
+	
+	SetRegister(memory_GND, voltage);
+	return OK;
+}
+int EnableSV(int port, bool state)
+{
+	// PORT = FIVE_V_E or TWELVE_V_E or TWO_EIGHT_V_E
+	// State = true means enable // State = false means disable
+	if(state) PORT_SV |= (1<<port);
+	else PORT_SV &= ~(1<<port);
+	
+	return OK;
+}
+int EnableCL(int port, bool state)
+{
+	// PORT = CL1_E or CL2_E or CL3_E
+	// State = true means enable // State = false means disable
+	if(state) PORT_CL_E &= ~(1<<port);
+	else PORT_CL_E |= (1<<port);
+	
+	return OK;
+}
+int MeasureV(int port, int* val)
+{
+	// port = HV_VOLTAGE or HV_GROUND or PICOMOTOR_VOLTAGE or BUS_CURR or BUS_VOLT or SEP_VOLT
+	// OUTPUT val = value to be returned
+	int error;
+	
+	error = ADC_READ(port,val);
+	if(error) return error;
+	
+	SetRegister(memory_PICOMOTOR_V_FB + port, *val);
+	return OK; 
+}
+int HVFeedback(uint16_t code)
+{
+	// Feedback of HV_VOLTAGE or HV_GROUND once the output has settled to the DAC code [ADC]
+	return TWO_FIVE_V - (int)(((long)(0x3fff - (code & 0x3fff))*HV_FEEDBACK_SPAN + 0x3fff/2)/0x3fff);
+}
+bool IsCLFault(int CL_index)
+{
+	// CL_index = 1, 2 or 3
+	if (CL_index==1) return (PIN_CL_F2 & (1<<CL1_F));
+	if (CL_index==2) return (PIN_CL_F1 & (1<<CL2_F));
+	if (CL_index==3) return (PIN_CL_F1 & (1<<CL3_F));
+	else return CL_INDEX_OOB;
+}
+
+/*--------------------------------------------------
+                   SEPARATION DEVICE
+--------------------------------------------------*/
+int SEP_DEV_INIT(void)
+{
+	// Set pin as output
+	DDR_SD_TRIG |= (1<<SEP_DEV_TRIG);
+	
+	// Set pin to 0
+	PORT_SD_TRIG &= ~(1<<SEP_DEV_TRIG);
+	
+	// Set detection as input
+	DDR_SD_DET &= ~(1<<SEP_DEV_DET);
+	
+	return OK;
+} 
+int ReleaseMirror(long timeout_ms)
+{
+	// Set pin to 1
+	PORT_SD_TRIG |= (1<<SEP_DEV_TRIG);
+	
+	// Wait for incoming data
+	uint32_t counter = 0;
+	while ( IsMirrorConstrained() && (counter < 1000*timeout_ms)){
+		_delay_us(1);
+		++counter;
+	}
+	if(counter == 1000*timeout_ms) return SEPARATION_DEV_TIMEOUT;
+	
+	return OK;
+}
+bool IsMirrorConstrained(void){
+	// TODO
+	return (PIN_SD_DET & (1<<SEP_DEV_DET));
+}
+
+/*--------------------------------------------------
+                  PICOMOTORS/ENCODERS
+--------------------------------------------------*/
+const int IOEaddr = 0x40;
+const int IOEport[3] = {0x12,0x13,0x13};
+const int IOEpin[12] = {1,0,3,2,1,0,3,2,5,4,7,6};
+
+int PICOMOTORS_INIT(void)
+{
+	int error;
+	
+	// Set Encoders as inputs
+	//DDR_ENCODER0 &= ~((1<<ENCODER0A) | (1<<ENCODER0B));
+	//DDR_ENCODER1 &= ~((1<<ENCODER1A) | (1<<ENCODER1B));
+	//DDR_ENCODER2 &= ~((1<<ENCODER2A) | (1<<ENCODER2B));
+	
+	// Set CONFIGURATION bits to 0
+	error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, 0x0A, 0x00},3);
+	if (error) return error;
+	
+	// Set PortA pins as outputs (via IODIRA)
+	error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, 0x00, 0x00},3);
+	if (error) return error;
+	
+	// Set PortB pins as outputs (via IODIRB)
+	error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, 0x01, 0x00},3);
+	if (error) return error;
+	
+	// Deactivate PortA pull-up resistors
+	error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, 0x0C, 0x00},3);
+	if (error) return error;
+	
+	// Deactivate PortB pull-up resistors
+	error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, 0x0D, 0x00},3);
+	if (error) return error;
+	
+	// Set PortA pins to 0
+	error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, 0x12, 0x00},3);
+	if (error) return error;
+
+	// Set PortB pins to 0
+	error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, 0x13, 0x00},3);
+	if (error) return error;
+
+	return OK;
+}
+int MovePicomotor(int index, signed int ticks)
+{
+	PROFILE_FUNCTION(PROFILE_MOVE_PICOMOTOR);
+	// INFO: @4MHz SPI clock, full message takes 37us to be sent
+	//ticks < 0 <=> BACKWARD
+	//ticks > 0 <=> FORWARD
+	int error = 0;
+	int II = 0;
+	
+	if(ticks>0)
+	{
+		//MOVE FORWARD
+		for (II=0; II<ticks; II++){
+			error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, IOEport[index], 1 << IOEpin[4*index]},3);
+			if (error) goto end;
+			_delay_us(326); // The delay was shorten by 2 full message durations. The next message is happening 37us earlier than Nicolas' code
+			error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, IOEport[index], 0},3);
+			if (error) goto end;
+			_delay_us(10); // Unchanged. Message delay accounted in the previous pause.
+			error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, IOEport[index], 1 << IOEpin[4*index+1]},3);
+			if (error) goto end;
+			_delay_us(63); // Accounted for message delay
+			error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, IOEport[index], 0},3);
+			if (error) goto end; 
+			_delay_us(2463); // Accounted for message delay
+		}
+		
+	}
+	else if(ticks<0)
+	{
+		//BACKWARD
+		for (II=0; II>ticks; II--){
+			error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, IOEport[index], 1 << IOEpin[4*index+2]},3);
+			if (error) goto end;
+			_delay_us(63); // Accounted for message delay
+			error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, IOEport[index], 0},3);
+			if (error) goto end;
+			_delay_us(63); // Accounted for message delay
+			error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, IOEport[index], 1 << IOEpin[4*index+3]},3);
+			if (error) goto end;
+			_delay_us(363); // Accounted for message delay
+			error = SPI_WRITE(SELECT_PICO,(uint8_t [3]){IOEaddr, IOEport[index], 0},3);
+			if (error) goto end;
+			_delay_us(2363); // Accounted for message delay
+		}
+	}
+	
+	end:
+	// Update memory vector
+	SetRegister(memory_PICO0_TICKS + index, REGISTER[memory_PICO0_TICKS + index] + II);
+
+	return error;
+}
+int GetEncoderState(int index, int* state)
+{
+	PROFILE_FUNCTION(PROFILE_ENCODER_STATE);
+	// INPUT  index = 0 or 1 or 2 depending on the encoder
+	// OUTPUT state = state00 or state10 or state11 or state01 (depending of state of channel A and B resp.)
+	
+	if(index==0){
+		char PIN = PIN_ENCODER0;
+		if ((PIN & (1<<ENCODER0A)) && (PIN & (1<<ENCODER0B))) {SetRegister(memory_ENCODER0_STATE, state11); *state = state11; return OK;}
+		if ((PIN & (1<<ENCODER0A)) && !(PIN & (1<<ENCODER0B))) {SetRegister(memory_ENCODER0_STATE, state10); *state = state10; return OK;}
+		if (!(PIN & (1<<ENCODER0A)) && (PIN & (1<<ENCODER0B))) {SetRegister(memory_ENCODER0_STATE, state01); *state = state01; return OK;}
+		if (!(PIN & (1<<ENCODER0A)) && !(PIN & (1<<ENCODER0B))) {SetRegister(memory_ENCODER0_STATE, state00); *state = state00; return OK;}
+	}
+	if(index==1){
+		char PIN = PIN_ENCODER1;
+		if ((PIN & (1<<ENCODER1A)) && (PIN & (1<<ENCODER1B))) {SetRegister(memory_ENCODER1_STATE, state11); *state = state11; return OK;}
+		if ((PIN & (1<<ENCODER1A)) && !(PIN & (1<<ENCODER1B))) {SetRegister(memory_ENCODER1_STATE, state10); *state = state10; return OK;}
+		if (!(PIN & (1<<ENCODER1A)) && (PIN & (1<<ENCODER1B))) {SetRegister(memory_ENCODER1_STATE, state01); *state = state01; return OK;}
+		if (!(PIN & (1<<ENCODER1A)) && !(PIN & (1<<ENCODER1B))) {SetRegister(memory_ENCODER1_STATE, state00); *state = state00; return OK;}
+	}
+	if(index==2){
+		char PIN = PIN_ENCODER2;
+		if ((PIN & (1<<ENCODER2A)) && (PIN & (1<<ENCODER2B))) {SetRegister(memory_ENCODER2_STATE, state11); *state = state11; return OK;}
+		if ((PIN & (1<<ENCODER2A)) && !(PIN & (1<<ENCODER2B))) {SetRegister(memory_ENCODER2_STATE, state10); *state = state10; return OK;}
+		if (!(PIN & (1<<ENCODER2A)) && (PIN & (1<<ENCODER2B))) {SetRegister(memory_ENCODER2_STATE, state01); *state = state01; return OK;}
+		if (!(PIN & (1<<ENCODER2A)) && !(PIN & (1<<ENCODER2B))) {SetRegister(memory_ENCODER2_STATE, state00); *state = state00; return OK;}
+	}
+	
+	return ENCODER_STATE_CRITICAL;
+}
+const char MPaddr[2] = {0x98,0x84};
+const bool MPIC[42] = {1,1,1,1,1,1,0,0,0,0,0,0,0,0,1,1,1,0,0,0,0,0,0,0,0,1,1,1,0,0,0,0,0,0,0,0,1,1,1,1,1,1};
+const char MPport[42] = {0x38,0x39,0x3B,0x3C,0x3E,0x3F,0x2C,0x29,0x2A,0x2E,0x2F,0x30,0x32,0x33,0x37,0x3A,0x3D,0x28,0x2D,0x2B,0x31,0x3A,0x27,0x3E,0x24,0x2E,0x31,0x34,0x39,0x38,0x3C,0x3B,0x26,0x3D,0x3F,0x25,0x2D,0x2C,0x30,0x2F,0x33,0x32};
+
+int MULTIPLEXER_INIT(int i)
+{
+	// Integer to return
+	int status;
+
+			// Set mode to normal
+			status = I2C_WRITE(MPaddr[i],(uint8_t [2]){0x04, 0x01},2); //Send message
+			if(status) return status;
+			
+			// Set global current to 10.5mA for 0x06, 12mA for 0x07
+			status = I2C_WRITE(MPaddr[i], (uint8_t [2]){0x02, 0x06},2); //Send message
+			if(status) return status;
+			
+			// Set all pins to LED segment driver configuration (LED = switch)
+			for (char cmd = 0x09; cmd <= 0x0F; cmd++)
+			{
+				status = I2C_WRITE(MPaddr[i], (uint8_t [2]){cmd, 0},2); //Send message
+				if(status) return status;
+			}
+			
+			// Disable nonexistent ports on smaller multiplexer
+			if (i%2==1)
+			{
+				status = I2C_WRITE(MPaddr[i], (uint8_t [2]){0x09, 0x55},2); //Send message
+				if(status) return status;
+				status = I2C_WRITE(MPaddr[i], (uint8_t [2]){0x0A, 0x55},2); //Send message
+				if(status) return status;
+			}
+			
+			// Set all output values to 0
+			for (char cmd = 0x44; cmd <= 0x5c; cmd += 8)
+			{
+				status = I2C_WRITE(MPaddr[i], (uint8_t [2]){cmd, 0},2); //Send message
+				if(status) return status;
+			}
+	
+	return OK;
+}
+int ChannelOn(int ch)
+{
+	int status = I2C_WRITE(MPaddr[ch/42+MPIC[ch%42]], (uint8_t [2]){MPport[ch%42], 1},2); //Send message
+	if(!status) SetRegister(memory_MUX_ACTIVE_CH, ch);
+	return status;
+}
+int ChannelOff(int ch)
+{
+	int status = I2C_WRITE(MPaddr[ch/42+MPIC[ch%42]], (uint8_t [2]){MPport[ch%42], 0},2); //Send message
+	if(!status) SetRegister(memory_MUX_ACTIVE_CH, -1);
+	return status;
+}
+
+/*--------------------------------------------------
+                   THERMO-SENSORS
+--------------------------------------------------*/
+const uint8_t MCP9801addr[1] = {0x9E};
+const uint8_t TMP006addr[0] = {};
+const float S0[1] = {1.0};
+
+int TEMP_SENSORS_INIT(void){
+	int status;
+	
+	// MCP9801 (9-bit precision)
+	for(int II=0; II < (sizeof(MCP9801addr)/sizeof(uint8_t)); II++){
+		status = I2C_WRITE(MCP9801addr[II], (uint8_t [2]){0x01, 0}, 2);
+		if(status) return status;
+	}
+	
+	// TMP006
+	for(int II=0; II < (sizeof(TMP006addr)/sizeof(uint8_t)); II++){
+		status = I2C_WRITE(TMP006addr[II], (uint8_t [3]){0x02, 0x74, 0}, 3);
+		if(status) return status;
+	}
+	
+	
+	return OK;
+}
+int GetTemperatureMCP9801(int sensor_index, int16_t * temperature_128){	
+	
+	// Check index
+	if(sensor_index >= (sizeof(MCP9801addr)/sizeof(uint8_t))) return SENSOR_INDEX_OOB;
+	
+	uint8_t read_data[2];
+	
+	int status = I2C_READ(MCP9801addr[sensor_index], (uint8_t [1]){0}, 1, read_data, 2);
+	if(status) return status;
+	
+	uint16_t sign = (read_data[0] & 0x80) && (0x80); // 0 = +, 1 == -
+	uint16_t temp_128_abs = (((read_data[0] &  0x7F)<<8) + read_data[1]) >> 1;
+	
+	SetRegister(memory_TEMP_MCP9801_1+sensor_index, ((int16_t)(1-2*sign))*temp_128_abs);
+	*temperature_128 = ((int16_t)(1-2*sign))*temp_128_abs;
+	
+	return OK;
+}
+int GetTemperatureTMP006(int sensor_index, int16_t * temperature_128){
+	// Check index
+	if(sensor_index >= (sizeof(TMP006addr)/sizeof(uint8_t))) return SENSOR_INDEX_OOB;
+	
+	uint8_t read_data[2];
+	
+	// Extract T_DIE
+	int status = I2C_READ(TMP006addr[sensor_index], (uint8_t [1]){0x01}, 1, read_data, 2);
+	if(status) return status;
+	
+	float T_DIE = (float)((read_data[0]<<8) + read_data[1])/128;
+	
+	// EXTRACT V_SENSOR
+	status = I2C_READ(TMP006addr[sensor_index], (uint8_t [1]){0x00}, 1, read_data, 2);
+	if(status) return status;
+	
+	float V_SENSOR = (float)((read_data[0]<<8) + read_data[1]);
+	
+	// Temperature calculation
+	float T_REF = 298.15;
+	float S = S0[sensor_index]*( 1 + 0.00175*( T_DIE - T_REF ) - 0.00001678*pow(T_DIE - T_REF,2));
+	float V_OS = -0.0000294 - 0.00000057*(T_DIE - T_REF) + 0.00000000463*pow(T_DIE - T_REF,2);
+	float f = (V_SENSOR - V_OS) + 13.4*pow(V_SENSOR - V_OS,2);
+	float T_OBJ = pow(pow(T_DIE,4) + (f/S),0.25);
+	
+	SetRegister(memory_TEMP_TMP006_1+sensor_index, T_OBJ*128);
+	*temperature_128 = T_OBJ*128;
+	
+	return OK;
+}
+
+/*--------------------------------------------------
+                     EXT EEPROM
+--------------------------------------------------*/
+const char EXT_EEPROM_ADDR[1] = {0xA0};
+uint8_t ExtEepromPage[2 + EXT_EEPROM_PAGE_SIZE];
+uint16_t ExtEepromAddr;
+int ExtEepromFill;
+bool ExtEepromWriting = false;
+
+int WaitEEPROM(uint32_t eeprom_SLA_index)
+{
+	// Wait for the end of the write cycle: the EEPROM does not acknowledge its address while writing (ACK polling)
+	if(!ExtEepromWriting) return OK;
+	
+	uint32_t start = GetMicros();
+	int status;
+	while((status = I2C_POLL(EXT_EEPROM_ADDR[eeprom_SLA_index])) == I2C_ADDR_NACK){
+		if(GetMicros() - start > EXT_EEPROM_WRITE_MAX_US) return EXT_EEPROM_BUSY;
+		CheckWatchdogSave(); // Blocking wait (see Memory.h)
+	}
+	if(status) return status;
+	
+	ExtEepromWriting = false;
+	return OK;
+}
+int WriteExtEepromPage(uint32_t eeprom_SLA_index)
+{
+	// Wait for the end of the previous write cycle. It runs while the next page is received.
+	int status = WaitEEPROM(eeprom_SLA_index);
+	if(status) return status;
+	
+	// Send the bytes of the page (partial page write if not full)
+	uint16_t start = ExtEepromAddr - ExtEepromFill;
+	ExtEepromPage[0] = start >> 8;
+	ExtEepromPage[1] = start;
+	status = I2C_WRITE(EXT_EEPROM_ADDR[eeprom_SLA_index], ExtEepromPage, 2+ExtEepromFill);
+	if(status) return status;
+	
+	ExtEepromWriting = true;
+	ExtEepromFill = 0;
+	return OK;
+}
+int StartWriteinEEPROM(uint32_t eeprom_SLA_index, uint16_t address, uint16_t len){
+	// Start writing len bytes from address (any offset)
+	
+	// CHECK THE ADDRESS IS CORRECT
+	if(eeprom_SLA_index + (uint32_t)1 > (uint32_t)(sizeof(EXT_EEPROM_ADDR)/sizeof(char))) return EXT_EEPROM_WRONG_ADDR;
+	
+	// CHECK THAT THE EEPROM IS LARGE ENOUGH
+	if ((uint32_t)address + len - 1 > EXT_EEPROM_MAX_ADDR) return EXT_EEPROM_OVERFLOW;
+	
+	ExtEepromAddr = address;
+	ExtEepromFill = 0;
+	return OK;
+}
+int PushinEEPROM(uint32_t eeprom_SLA_index, uint8_t * buffer, int len){
+	// Add bytes to the page being filled. Write the page when the next byte is on another page
+	for (int II = 0; II < len; II++){
+		if(ExtEepromAddr > EXT_EEPROM_MAX_ADDR) return EXT_EEPROM_OVERFLOW;
+		
+		ExtEepromPage[2 + ExtEepromFill++] = buffer[II];
+		ExtEepromAddr++;
+		
+		if(ExtEepromAddr % EXT_EEPROM_PAGE_SIZE == 0){
+			int status = WriteExtEepromPage(eeprom_SLA_index);
+			if(status) return status;
+		}
+	}
+	return OK;
+}
+int EndWriteinEEPROM(uint32_t eeprom_SLA_index){
+	// Write the last (incomplete) page
+	if(ExtEepromFill == 0) return OK;
+	return WriteExtEepromPage(eeprom_SLA_index);
+}
+int ReadinEEPROM(uint32_t eeprom_SLA_index, uint16_t eeprom_address, uint8_t * buffer, uint16_t len){
+	// Sequential read: the EEPROM increments the address itself, so len bytes are read in one I2C transaction
+	
+	// CHECK THE ADDRESS IS CORRECT
+	if(eeprom_SLA_index + (uint32_t)1 > (uint32_t)(sizeof(EXT_EEPROM_ADDR)/sizeof(char))) return EXT_EEPROM_WRONG_ADDR;
+	
+	// CHECK THAT THE EEPROM IS LARGE ENOUGH
+	if (len == 0) return OK;
+	if ((uint32_t)eeprom_address + len - 1 > EXT_EEPROM_MAX_ADDR) return EXT_EEPROM_OVERFLOW;
+	
+	int status = WaitEEPROM(eeprom_SLA_index);
+	if(status) return status;
+	
+	uint8_t byte_addr[2] = {eeprom_address>>8,eeprom_address};
+	return I2C_READ(EXT_EEPROM_ADDR[eeprom_SLA_index], byte_addr, 2, buffer, len);
+}
+int ReadCodeinEEPROM(uint32_t eeprom_SLA_index, uint16_t eeprom_address, uint8_t * byte){
+	
+	uint8_t read_bytes[1];
+	int status = ReadinEEPROM(eeprom_SLA_index, eeprom_address + 2, read_bytes, 1); // Skip length bytes
+	if(status) return status;
+	
+	
+	SetRegister(memory_EEPROM_CODE_BYTE, (REGISTER[memory_EEPROM_CODE_BYTE]<<8) | (uint32_t)read_bytes[0]);
+	
+	*byte = read_bytes[0];
+	
+	return OK;
+}
+int GetSizeofCode(uint32_t eeprom_SLA_index, int * len){
+	
+	// CHECK THE ADDRESS IS CORRECT
+	if(eeprom_SLA_index + (uint32_t)1 > (uint32_t)(sizeof(EXT_EEPROM_ADDR)/sizeof(char))) return EXT_EEPROM_WRONG_ADDR;
+	
+	uint16_t eeprom_page_address = 0; //Make sure we start at beginning of page
+	
+	// CHECK THAT THE EEPROM IS LARGE ENOUGH
+	if (eeprom_page_address + 1> EXT_EEPROM_MAX_ADDR) return EXT_EEPROM_OVERFLOW;
+	
+	int status = WaitEEPROM(eeprom_SLA_index);
+	if(status) return status;
+	
+	uint8_t byte_addr[2] = {eeprom_page_address>>8,eeprom_page_address};
+	uint8_t read_bytes[2];
+	status = I2C_READ(EXT_EEPROM_ADDR[eeprom_SLA_index], byte_addr, 2, read_bytes, 2);
+	if(status) return status;
+
+	SetRegister(memory_EEPROM_CODE_LENGTH, (read_bytes[0]<<8) + read_bytes[1]);
+	*len = (read_bytes[0]<<8) + read_bytes[1];
+	
+	return OK;
+}
+int WriteinEEPROM(uint32_t eeprom_SLA_index, uint16_t eeprom_address, uint8_t * buffer, uint16_t len){
+	// Write len bytes from eeprom_address (partial pages are not padded)
+	int status = StartWriteinEEPROM(eeprom_SLA_index, eeprom_address, len);
+	if(status) return status;
+	
+	status = PushinEEPROM(eeprom_SLA_index, buffer, len);
+	if(status) return status;
+	
+	return EndWriteinEEPROM(eeprom_SLA_index);
+}
+int ReceiveChunk(int port, int command, uint8_t * chunk, int len){
+	// Receive len bytes followed by their CRC-16 (MSB first)
+	// A chunk with a wrong CRC is acknowledged with a feedback (command, EXT_EEPROM_CRC) and must be sent again
+	for(int retries = 0; retries <= EXT_EEPROM_MAX_RETRY; retries++)
+	{
+		int status = LoadMessage(port, chunk, len + 2, REGISTER[memory_COMMUNICATION_TIMEOUT]);
+		if(status) return status;
+		
+		if(Crc16(0xFFFF, chunk, len) == (((uint16_t)chunk[len] << 8) | chunk[len + 1])) return OK;
+		
+		if(retries < EXT_EEPROM_MAX_RETRY){
+			status = SendFeedback(port, command, EXT_EEPROM_CRC);
+			if(status) return status;
+		}
+	}
+	return EXT_EEPROM_CRC;
+}
+int UploadCodeinEEPROM(int port, uint32_t eeprom_SLA_index, uint16_t len){
+	// Receive the code from the camera and write it page by page (the whole code is never stored in the RAM)
+	// The camera sends the code in chunks of EXT_EEPROM_PAGE_SIZE bytes (last one may be shorter), each followed by its CRC-16 (MSB first).
+	// Each chunk is written and then acknowledged with a feedback (245, status), so the EEPROM write cycle runs while the next chunk arrives.
+	// A chunk with a wrong CRC is acknowledged with EXT_EEPROM_CRC and must be sent again.
+	// The last chunk is acknowledged by the final feedback of the command.
+	// The header holds EXT_EEPROM_NO_CODE until the last chunk is written: an interrupted upload never looks complete.
+	int status = StartWriteinEEPROM(eeprom_SLA_index, 0, len + 2);
+	if(status) return status;
+	
+	// Length of the code: invalid for now
+	status = PushinEEPROM(eeprom_SLA_index, (uint8_t [2]){EXT_EEPROM_NO_CODE >> 8, EXT_EEPROM_NO_CODE & 0xFF}, 2);
+	if(status) return status;
+	
+	uint8_t chunk[EXT_EEPROM_PAGE_SIZE + 2];
+	uint16_t received = 0;
+	
+	while(received < len)
+	{
+		int chunk_len = (len - received < EXT_EEPROM_PAGE_SIZE) ? len - received : EXT_EEPROM_PAGE_SIZE;
+		
+		// Receive the chunk and check its CRC
+		status = ReceiveChunk(port, 245, chunk, chunk_len);
+		if(status) return status;
+		
+		// Write it
+		status = PushinEEPROM(eeprom_SLA_index, chunk, chunk_len);
+		if(status) return status;
+		received += chunk_len;
+		
+		// Acknowledge it
+		if(received < len){
+			status = SendFeedback(port, 245, OK);
+			if(status) return status;
+		}
+	}
+	status = EndWriteinEEPROM(eeprom_SLA_index);
+	if(status) return status;
+	
+	// Length of the code, once the whole code is written
+	status = StartWriteinEEPROM(eeprom_SLA_index, 0, 2);
+	if(status) return status;
+	status = PushinEEPROM(eeprom_SLA_index, (uint8_t [2]){len >> 8, len}, 2);
+	if(status) return status;
+	return EndWriteinEEPROM(eeprom_SLA_index);
+}
+int DeltaUpdateinEEPROM(int port, uint32_t eeprom_SLA_index, uint16_t len){
+	// Update the code in the EEPROM by rewriting only the pages that changed
+	// The image is the length (2 bytes) followed by the code, cut in pages of EXT_EEPROM_PAGE_SIZE bytes from address 0 (last one may be shorter).
+	// 1. The camera sends the CRC-16 of each page of the new image (MSB first), in chunks of EXT_EEPROM_CRC_BLOCK CRCs, each followed by its CRC-16.
+	//    Each chunk is compared with the CRCs of the pages in the EEPROM and acknowledged with a feedback (249, status).
+	// 2. After the last chunk, the feedback (249, number of changed pages) is followed by a bitmap of the changed pages (bit 0 of byte 0 = page 0).
+	// 3. The camera sends the changed pages in order, each followed by its CRC-16, acknowledged as in UploadCodeinEEPROM.
+	// The last page is acknowledged by the final feedback of the command.
+	
+	// CHECK THE ADDRESS IS CORRECT
+	if(eeprom_SLA_index + (uint32_t)1 > (uint32_t)(sizeof(EXT_EEPROM_ADDR)/sizeof(char))) return EXT_EEPROM_WRONG_ADDR;
+	
+	// CHECK THAT THE EEPROM IS LARGE ENOUGH
+	uint32_t image_len = (uint32_t)len + 2;
+	if (image_len - 1 > EXT_EEPROM_MAX_ADDR) return EXT_EEPROM_OVERFLOW;
+	
+	int pages = (image_len + EXT_EEPROM_PAGE_SIZE - 1) / EXT_EEPROM_PAGE_SIZE;
+	uint8_t changed[EXT_EEPROM_PAGE_COUNT / 8] = {0};
+	int changed_count = 0;
+	uint8_t chunk[EXT_EEPROM_PAGE_SIZE + 2];
+	int status;
+	
+	// COMPARE THE PAGE CRCS
+	for(int block = 0; block < pages; block += EXT_EEPROM_CRC_BLOCK)
+	{
+		int block_len = (pages - block < EXT_EEPROM_CRC_BLOCK) ? pages - block : EXT_EEPROM_CRC_BLOCK;
+		
+		status = ReceiveChunk(port, 249, chunk, 2*block_len);
+		if(status) return status;
+		
+		for(int II = 0; II < block_len; II++)
+		{
+			int page = block + II;
+			uint16_t address = page * EXT_EEPROM_PAGE_SIZE;
+			int page_len = (image_len - address < EXT_EEPROM_PAGE_SIZE) ? image_len - address : EXT_EEPROM_PAGE_SIZE;
+			
+			uint8_t stored[EXT_EEPROM_PAGE_SIZE];
+			status = ReadinEEPROM(eeprom_SLA_index, address, stored, page_len);
+			if(status) return status;
+			
+			if(Crc16(0xFFFF, stored, page_len) != (((uint16_t)chunk[2*II] << 8) | chunk[2*II + 1])){
+				changed[page / 8] |= 1 << (page % 8);
+				changed_count++;
+			}
+		}
+		
+		// Acknowledge the chunk (the last one is acknowledged with the bitmap)
+		if(block + block_len < pages){
+			status = SendFeedback(port, 249, OK);
+			if(status) return status;
+		}
+	}
+	
+	// SEND THE BITMAP OF CHANGED PAGES
+	status = SendFeedback(port, 249, changed_count);
+	if(status) return status;
+	status = SendBytes(port, changed, (pages + 7) / 8);
+	if(status) return status;
+	
+	// WRITE THE CHANGED PAGES
+	for(int page = 0; page < pages; page++)
+	{
+		if(!(changed[page / 8] & (1 << (page % 8)))) continue;
+		
+		uint16_t address = page * EXT_EEPROM_PAGE_SIZE;
+		int page_len = (image_len - address < EXT_EEPROM_PAGE_SIZE) ? image_len - address : EXT_EEPROM_PAGE_SIZE;
+		
+		status = ReceiveChunk(port, 249, chunk, page_len);
+		if(status) return status;
+		
+		// The first page starts with the length of the code
+		if(page == 0 && (((uint16_t)chunk[0] << 8) | chunk[1]) != len) return EXT_EEPROM_WRONG_ADDR;
+		
+		// Write it (the write cycle runs while the next page is received)
+		status = StartWriteinEEPROM(eeprom_SLA_index, address, page_len);
+		if(status) return status;
+		status = PushinEEPROM(eeprom_SLA_index, chunk, page_len);
+		if(status) return status;
+		status = EndWriteinEEPROM(eeprom_SLA_index);
+		if(status) return status;
+		
+		// Acknowledge it
+		if(--changed_count > 0){
+			status = SendFeedback(port, 249, OK);
+			if(status) return status;
+		}
+	}
+	
+	return OK;
+}
+
+/*--------------------------------------------------
+                   WATCHDOG TIMER
+--------------------------------------------------*/
+int WATCHDOG_INIT(void){
+	cli(); // Disable interrupts
+	
+	// Start timed sequence
+	WDTCSR |= (1<<WDCE) | (1<<WDE); 
+	
+	// Set configuration to "Interrupt + System Reset", Timer to 8s
+	WDTCSR = (1<<WDIE) |(1<<WDE) | (1<<WDP3) | (1<<WDP0);
+	
+	sei(); // Enable interrupts
+	return OK;
+}
+void resetWatchdogTimer(void){
+	wdt_reset();
+}
+void DisableWatchdogTimer(void){
+	wdt_disable();
+}
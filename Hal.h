@@ -0,0 +1,92 @@
+/*
+ * Hal.h
+ *
+ * Hardware access used by Interfaces.h: the few register sequences that start an action on a peripheral
+ * and wait for its end. Configuration registers and GPIO are used directly.
+ * The functions are inlined in each unit that includes it.
+ * The simulator (sim/) provides the same functions on the host, with a virtual clock.
+ */ 
+
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdint.h>
+
+#ifdef SIMULATOR
+#include "sim/SimHal.h"
+#else
+
+#include <avr/io.h>
+
+/*--------------------------------------------------
+                       USART
+--------------------------------------------------*/
+static inline void HAL_USART0_TX(uint8_t byte)
+{
+	// Wait for empty transmit buffer, then start transmission
+	while ( !(UCSR0A & (1<<UDRE0)) );
+	UDR0 = byte;
+}
+static inline void HAL_USART1_TX(uint8_t byte)
+{
+	// Wait for empty transmit buffer, then start transmission
+	while ( !(UCSR1A & (1<<UDRE1)) );
+	UDR1 = byte;
+}
+
+/*--------------------------------------------------
+                        SPI
+--------------------------------------------------*/
+static inline uint8_t HAL_SPI_TRANSFER(uint8_t byte)
+{
+	// Start transmission and wait for transmission complete
+	SPDR = byte;
+	while(!(SPSR & (1<<SPIF)));
+	return SPDR;
+}
+// Called once the chip select lines are released (end of a frame for the device)
+#define HAL_SPI_END()
+
+/*--------------------------------------------------
+                        TWI
+--------------------------------------------------*/
+static inline void HAL_TWI(uint8_t control)
+{
+	// Start an action (start, address/data transmission or reception) and wait for its end
+	// The status is then in TW_STATUS, and the received byte in TWDR
+	TWCR = control;
+	while (!(TWCR & (1<<TWINT)));
+}
+static inline void HAL_TWI_STOP(void)
+{
+	// Transmit STOP condition (TWINT is not set after a stop)
+	TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTO);
+}
+
+/*--------------------------------------------------
+                        ADC
+--------------------------------------------------*/
+static inline uint16_t HAL_ADC_CONVERT(void)
+{
+	// Convert the channel selected in ADMUX
+	ADCSRA |= (1<<ADSC);
+	while(ADCSRA & (1<<ADSC));
+	
+	uint16_t data = ADCL;
+	data |= (ADCH<<8);
+	return data;
+}
+
+/*--------------------------------------------------
+                       TIME
+--------------------------------------------------*/
+// Called by the loops that wait on a flag or on the time (the simulator lets the virtual time run)
+#define HAL_POLL()
+
+// Count of Timer1 (cycle counter of the profiler, see Profiler.h)
+#define HAL_TIMER1_COUNT() TCNT1
+
+#endif /* SIMULATOR */
+
+#endif /* HAL_H_ */
@@ -0,0 +1,736 @@
+/*
+ * Interfaces.c
+ *
+ * Interfaces with the hardware: USART, SPI, I2C, ADC and timer (see Interfaces.h).
+ */
+
+#include "Interfaces.h"
+
+/*--------------------------------------------------
+                       CODE LED
+--------------------------------------------------*/
+void BlinkLED(void){
+	DDR_LED |= (1<<LED);
+	_delay_ms(500);
+	PORT_LED |= (1<<LED);
+	_delay_ms(500);
+	PORT_LED &= ~(1<<LED);
+	
+}
+
+/*--------------------------------------------------
+                  USART BAUD RATE
+--------------------------------------------------*/
+const struct usart_setting USART_SETTINGS[] PROGMEM = {
+	USART_SETTING(2400UL), USART_SETTING(4800UL), USART_SETTING(9600UL), USART_SETTING(19200UL),
+	USART_SETTING(38400UL), USART_SETTING(57600UL), USART_SETTING(115200UL), USART_SETTING(230400UL),
+	USART_SETTING(250000UL), USART_SETTING(500000UL), USART_SETTING(1000000UL)
+};
+
+bool GetBaudSetting(unsigned long baud, struct usart_setting * setting)
+{
+	// Setting for a baud rate: from the table, or computed for the other rates. Return false if the error is too large
+	int II;
+	for(II = 0; II < (int)(sizeof(USART_SETTINGS)/sizeof(USART_SETTINGS[0])); II++){
+		if(pgm_read_dword(&USART_SETTINGS[II].baud) == baud) break;
+	}
+	
+	if(II < (int)(sizeof(USART_SETTINGS)/sizeof(USART_SETTINGS[0]))) memcpy_P(setting, &USART_SETTINGS[II], sizeof(*setting));
+	else if(baud == 0 || baud > F_CPU/8) return false;
+	else{
+		// Compare normal and double speed
+		setting->baud = baud;
+		setting->ubrr = 0xFFFF;
+		setting->u2x = false;
+		setting->error = 0x7FFF;
+		for(unsigned long div = 16; div >= 8; div -= 8){
+			unsigned long ubrr = (F_CPU + div*baud/2) / (div*baud);
+			if(ubrr == 0) continue;
+			ubrr -= 1;
+			if(ubrr > 4095) continue;
+			long error = (long)((10000ULL*F_CPU) / (div*(ubrr + 1)*baud)) - 10000;
+			if(USART_ABS(error) < USART_ABS(setting->error)){
+				setting->ubrr = ubrr;
+				setting->u2x = (div == 8);
+				setting->error = error;
+			}
+		}
+	}
+	
+	return setting->ubrr <= 4095 && USART_ABS(setting->error) <= USART_MAX_BAUD_ERROR;
+}
+
+/*--------------------------------------------------
+                 SERIAL INTERFACE 0
+--------------------------------------------------*/
+static FILE mystdout0 = FDEV_SETUP_STREAM(USART0_PRINTF, NULL, _FDEV_SETUP_WRITE); // NOTE: USE printf TO SEND DATA
+volatile uint8_t USART0_RX_BUFFER[USART_RX_BUFFER_SIZE];
+volatile uint8_t USART0_RX_HEAD = 0;
+volatile uint8_t USART0_RX_TAIL = 0;
+volatile uint8_t USART0_RX_ERROR = OK;
+
+ISR(USART0_RX_vect)
+{
+	uint8_t status = UCSR0A;
+	uint8_t byte = UDR0;
+	uint8_t next = (USART0_RX_HEAD + 1) & (USART_RX_BUFFER_SIZE - 1);
+	
+	// Reception error (reported once by USART0_READ)
+	if(!USART0_RX_ERROR){
+		if(status & (1<<FE0)) USART0_RX_ERROR = UART0_INCORRECT_STOP;
+		else if(status & (1<<UPE0)) USART0_RX_ERROR = UART0_PARITY_CHECK;
+		else if((status & (1<<DOR0)) || next == USART0_RX_TAIL) USART0_RX_ERROR = UART0_FRAME_LOST; // Overrun or buffer full
+	}
+	
+	// Keep the byte (unless corrupted or no room left)
+	if(!(status & ((1<<FE0) | (1<<UPE0))) && next != USART0_RX_TAIL){
+		USART0_RX_BUFFER[USART0_RX_HEAD] = byte;
+		USART0_RX_HEAD = next;
+	}
+}
+int USART0_INIT(unsigned long USART_BAUDRATE)
+{
+	// TODO: Delete that line (this is just for simple testing)
+	stdout = &mystdout0; // To use printf     for output
+
+	// Check the baud rate error
+	struct usart_setting setting;
+	if(!GetBaudSetting(USART_BAUDRATE, &setting)) return UART0_BAUD_ERROR;
+	SetRegister(memory_USART0_BAUD, USART_BAUDRATE);
+	SetRegister(memory_USART0_BAUD_ERROR, setting.error);
+
+	// Set the baud rate (U2X = double speed)
+	UBRR0H = (uint8_t)(setting.ubrr>>8);
+	UBRR0L = (uint8_t)(setting.ubrr);
+	if(setting.u2x) UCSR0A |= (1<<U2X0);
+	else UCSR0A &= ~(1<<U2X0);
+	
+	// Enable receiver, transmitter and RX complete interrupt
+	UCSR0B = (1<<RXEN0) | (1<<TXEN0) | (1<<RXCIE0);
+	
+	// Set frame format: 8data, 1stop bit, parity mode disabled
+	UCSR0C = (3<<UCSZ00);
+	
+	// Flush the receive buffer
+	USART0_FLUSH();
+	
+	return OK;
+}
+int USART0_PRINTF(char var, FILE *stream)
+{
+	// TODO: Delete that function (this is just for simple testing)
+	HAL_USART0_TX(var);
+	
+	return OK;
+}
+int USART0_WRITE(char var)
+{
+	TRACE_BYTE(TRACE_USART0 | TRACE_TX, 0, var);
+	
+	// Wait for empty transmit buffer and start transmission
+	HAL_USART0_TX(var);
+	
+	return OK;
+}
+bool USART0_FLAG(void)
+{
+	// A byte (or a reception error) is waiting
+	HAL_POLL();
+	return (USART0_RX_HEAD != USART0_RX_TAIL) || USART0_RX_ERROR;
+}
+int USART0_READ(char* var, long timeout_ms)
+{
+	// Wait for incoming data
+	uint32_t counter = 0;
+	while ( !USART0_FLAG() && (counter < 1000*timeout_ms)){
+		 CheckWatchdogSave(); // Blocking wait (see Memory.h)
+		 _delay_us(1);
+		 ++counter;
+	}
+	if(!USART0_FLAG()) return UART0_TIMEOUT;
+	
+	// Incorrect stop, frame lost or parity check error (reported once)
+	if(USART0_RX_ERROR){
+		int error = USART0_RX_ERROR;
+		USART0_RX_ERROR = OK;
+		return error;
+	}
+	
+	*var = USART0_RX_BUFFER[USART0_RX_TAIL];
+	USART0_RX_TAIL = (USART0_RX_TAIL + 1) & (USART_RX_BUFFER_SIZE - 1);
+	TRACE_BYTE(TRACE_USART0 | TRACE_RX, 0, *var);
+	
+	return OK;
+}
+void USART0_FLUSH(void)
+{
+	USART0_RX_TAIL = USART0_RX_HEAD;
+	USART0_RX_ERROR = OK;
+}
+
+/*--------------------------------------------------
+                 SERIAL INTERFACE 1 
+--------------------------------------------------*/
+volatile uint8_t USART1_RX_BUFFER[USART_RX_BUFFER_SIZE];
+volatile uint8_t USART1_RX_HEAD = 0;
+volatile uint8_t USART1_RX_TAIL = 0;
+volatile uint8_t USART1_RX_ERROR = OK;
+
+ISR(USART1_RX_vect)
+{
+	uint8_t status = UCSR1A;
+	uint8_t byte = UDR1;
+	uint8_t next = (USART1_RX_HEAD + 1) & (USART_RX_BUFFER_SIZE - 1);
+	
+	// Reception error (reported once by USART1_READ)
+	if(!USART1_RX_ERROR){
+		if(status & (1<<FE1)) USART1_RX_ERROR = UART1_INCORRECT_STOP;
+		else if(status & (1<<UPE1)) USART1_RX_ERROR = UART1_PARITY_CHECK;
+		else if((status & (1<<DOR1)) || next == USART1_RX_TAIL) USART1_RX_ERROR = UART1_FRAME_LOST; // Overrun or buffer full
+	}
+	
+	// Keep the byte (unless corrupted or no room left)
+	if(!(status & ((1<<FE1) | (1<<UPE1))) && next != USART1_RX_TAIL){
+		USART1_RX_BUFFER[USART1_RX_HEAD] = byte;
+		USART1_RX_HEAD = next;
+	}
+}
+int USART1_INIT(unsigned long USART_BAUDRATE)
+{
+	// Check the baud rate error
+	struct usart_setting setting;
+	if(!GetBaudSetting(USART_BAUDRATE, &setting)) return UART1_BAUD_ERROR;
+	SetRegister(memory_USART1_BAUD, USART_BAUDRATE);
+	SetRegister(memory_USART1_BAUD_ERROR, setting.error);
+
+	// Set the baud rate (U2X = double speed)
+	UBRR1H = (uint8_t)(setting.ubrr>>8);
+	UBRR1L = (uint8_t)(setting.ubrr);
+	if(setting.u2x) UCSR1A |= (1<<U2X1);
+	else UCSR1A &= ~(1<<U2X1);
+	
+	// Enable receiver, transmitter and RX complete interrupt
+	UCSR1B = (1<<RXEN1) | (1<<TXEN1) | (1<<RXCIE1);
+	
+	// Set frame format: 8data, 1stop bit, parity mode disabled
+	UCSR1C = (3<<UCSZ10);
+	
+	// Flush the receive buffer
+	USART1_FLUSH();
+	
+	return OK;
+}
+int USART1_WRITE(char var)
+{
+	TRACE_BYTE(TRACE_USART1 | TRACE_TX, 0, var);
+	
+	// Wait for empty transmit buffer and start transmission
+	HAL_USART1_TX(var);
+	
+	return OK;
+}
+bool USART1_FLAG(void)
+{
+	// A byte (or a reception error) is waiting
+	HAL_POLL();
+	return (USART1_RX_HEAD != USART1_RX_TAIL) || USART1_RX_ERROR;
+}
+int USART1_READ(char* var, long timeout_ms)
+{
+	// Wait for incoming data
+	uint32_t counter = 0;
+	while ( !USART1_FLAG() && (counter < 1000*timeout_ms)){
+		CheckWatchdogSave(); // Blocking wait (see Memory.h)
+		_delay_us(1);
+		++counter;
+	}
+	if(!USART1_FLAG()) return UART1_TIMEOUT;
+	
+	// Incorrect stop, frame lost or parity check error (reported once)
+	if(USART1_RX_ERROR){
+		int error = USART1_RX_ERROR;
+		USART1_RX_ERROR = OK;
+		return error;
+	}
+	
+	*var = USART1_RX_BUFFER[USART1_RX_TAIL];
+	USART1_RX_TAIL = (USART1_RX_TAIL + 1) & (USART_RX_BUFFER_SIZE - 1);
+	TRACE_BYTE(TRACE_USART1 | TRACE_RX, 0, *var);
+	
+	return OK;
+}
+void USART1_FLUSH(void)
+{
+	USART1_RX_TAIL = USART1_RX_HEAD;
+	USART1_RX_ERROR = OK;
+}
+
+/*--------------------------------------------------
+                   SPI INTERFACE
+--------------------------------------------------*/
+int SPI_INIT(unsigned long F_SPI)
+{
+	/* Set MOSI, SCK and SS output, all others input (MISO) */
+	DDR_SPI |= (1<<MOSI_SPI)|(1<<SCK_SPI);
+	DDR_SS_PICO |= (1<<SS_PICO);
+	DDR_SS_HV |= (1<<SS_HV);
+	DDR_SS_BIAS |= (1<<SS_BIAS);
+	
+	SetRegister(memory_SPI_FREQ, F_SPI);
+	
+	/* Set clock */
+	int prescaler = ceil(log(F_CPU/F_SPI)/log(2)); //ceil to unsure frequency less then F_SPI
+	if(prescaler==1) {SPSR |= (1<<SPI2X); SPCR &= ~(1<<SPR1); SPCR &= ~(1<<SPR0);}
+	else if(prescaler==2) {SPSR &= ~(1<<SPI2X); SPCR &= ~(1<<SPR1); SPCR &= ~(1<<SPR0);}
+	else if(prescaler==3) {SPSR |= (1<<SPI2X); SPCR &= ~(1<<SPR1); SPCR |= (1<<SPR0);}
+	else if(prescaler==4) {SPSR &= ~(1<<SPI2X); SPCR &= ~(1<<SPR1); SPCR |= (1<<SPR0);}
+	else if(prescaler==5) {SPSR |= (1<<SPI2X); SPCR |= (1<<SPR1); SPCR &= ~(1<<SPR0);}
+	else if(prescaler==6) {SPSR &= ~(1<<SPI2X); SPCR |= (1<<SPR1); SPCR &= ~(1<<SPR0);}
+	else if(prescaler==7) {SPSR &= ~(1<<SPI2X); SPCR |= (1<<SPR1); SPCR |= (1<<SPR0);}
+	else return SPI_CLOCK_OOB;
+	
+	/* Enable SPI, Master */ // For PICO: CPOL = 0, CPHA = 0 // For HV: CPOL=0, CPHA = 1; 
+	SPCR = (1<<SPE)|(1<<MSTR);;
+	
+	/*Put SS line high */
+	PORT_SS_PICO |= (1<<SS_PICO);
+	PORT_SS_HV |= (1<<SS_HV);
+	PORT_SS_BIAS |= (1<<SS_BIAS);
+	
+	return OK;
+}
+int SPI_WRITE(int Select, uint8_t * data, int nbytes)
+{
+	PROFILE_FUNCTION(PROFILE_SPI_WRITE);
+	// Begin the transmission. Adjust phase (CPHA=0 for PICO, CPHA=1 for HV). Put SS line low
+	if(Select==SELECT_PICO) {SPCR &= ~(1<<CPHA); PORT_SS_PICO &= ~(1<<SS_PICO);} //PICO
+	if(Select==SELECT_HV) {SPCR |= (1<<CPHA); PORT_SS_HV &= ~(1<<SS_HV);} //HV
+	if(Select==SELECT_BIAS) {SPCR |= (1<<CPHA); PORT_SS_BIAS &= ~(1<<SS_BIAS);} //BIAS
+			
+	for(int II =0; II < nbytes; II++)
+	{	
+		TRACE_BYTE(TRACE_SPI | TRACE_TX, Select, data[II]);
+		// Transfer byte
+		HAL_SPI_TRANSFER(data[II]);
+	}
+
+	// End the transmission. Put SS line high
+	PORT_SS_PICO |= (1<<SS_PICO);
+	PORT_SS_HV |= (1<<SS_HV);
+	PORT_SS_BIAS |= (1<<SS_BIAS);
+	HAL_SPI_END();
+
+	return OK;
+}
+
+/*--------------------------------------------------
+                   I2C INTERFACE
+--------------------------------------------------*/
+int I2C_INIT(unsigned long F_I2C)
+{
+	SetRegister(memory_I2C_FREQ, F_I2C);
+	
+	// Set frequency of I2C
+	int prescaler = ((F_CPU/F_I2C)-16)/2;
+	if((prescaler < 0) || (prescaler > 255)) return I2C_CLOCK_OOB;
+	TWBR = prescaler;
+	
+	// Set max count of restart
+	SetRegister(memory_I2C_MAX_ITER, 2);
+	
+	return OK;
+}
+int I2C_WRITE(uint8_t SLA, uint8_t * data, int len)
+{
+	PROFILE_FUNCTION(PROFILE_I2C_WRITE);
+	//-------------------------------------------------------------------------------
+	//                          Initialization
+	//-------------------------------------------------------------------------------
+	// If no data to be sent, exit
+	if(len==0) return OK;
+	
+	// Make sure SLA is appropriate to do a "write" operation (LSB = 0)
+	SLA &= 0xFE;
+
+	// Status to be returned
+	int status = OK;
+
+	// Number of tries
+	int n = 1;
+
+	restart:
+	if (n++ > REGISTER[memory_I2C_MAX_ITER]) {goto quit;} //The device does not respond after MAX_ITER tries
+
+	//-------------------------------------------------------------------------------
+	//                                   Send START
+	//-------------------------------------------------------------------------------
+	// Send start
+	HAL_TWI((1<<TWINT)|(1<<TWSTA)|(1<<TWEN));
+
+	// Check the status of the interface
+	switch (TW_STATUS)
+	{
+		// Normal behavior
+		case TW_REP_START:
+		case TW_START:
+		break;
+		
+		// Lost arbitration. Should never happen
+		case TW_MT_ARB_LOST:
+		status = I2C_START_ARB_LOST;
+		goto restart;
+		
+		// Error. Should never happen. Do not send stop.
+		default:
+		return I2C_START_CRITICAL;
+	}
+
+	//-------------------------------------------------------------------------------
+	//                                Send Device Address
+	//-------------------------------------------------------------------------------
+	// Save address in Register
+	SetRegister(memory_I2C_SLA, SLA);
+	
+	// Load SLA+W into TWDR Register...
+	TWDR = SLA;
+
+	//...and send
+	HAL_TWI((1<<TWINT) | (1<<TWEN));
+
+	//4. Check the status of the interface
+	switch (TW_STATUS)
+	{
+		// Normal behavior. Address acknowledged
+		case TW_MT_SLA_ACK:
+		break;
+		
+		// Not acknowledged. Device busy. Restart.
+		case TW_MT_SLA_NACK:
+		status = I2C_ADDR_NACK;
+		goto restart;
+		// Lost arbitration. Should never happen
+		case TW_MT_ARB_LOST:
+		status = I2C_ADDR_ARB_LOST;
+		goto restart;
+		
+		// Error.
+		default:
+		status = I2C_ADDR_CRITICAL;
+		goto quit;
+	}
+
+	//-------------------------------------------------------------------------------
+	//                                      Send Data
+	//-------------------------------------------------------------------------------
+	for (int II=0; II<len; II++){
+		TRACE_BYTE(TRACE_I2C | TRACE_TX, SLA, data[II]);
+		
+		// Load data into TWDR Register... (and increment)
+		TWDR = data[II];
+		//...and send
+		HAL_TWI((1<<TWINT) | (1<<TWEN));
+
+		// Check the status of the interface
+		switch (TW_STATUS)
+		{
+			// Normal behavior. Data acknowledged
+			case TW_MT_DATA_ACK:
+			break;
+			
+			// Not acknowledged. Device busy. Restart.
+			case TW_MT_DATA_NACK:
+			status = I2C_DATA_NACK;
+			goto restart;
+			// Lost arbitration. Should never happen
+			case TW_MT_ARB_LOST:
+			status = I2C_DATA_ARB_LOST;
+			goto restart;
+			
+			// Error.
+			default:
+			status = I2C_DATA_CRITICAL;
+			goto quit;
+		}
+	}
+
+	//-------------------------------------------------------------------------------
+	//                                       Quit
+	//-------------------------------------------------------------------------------
+	quit:
+	//7. Transmit STOP condition
+	HAL_TWI_STOP();
+
+	return status;
+}
+int I2C_POLL(uint8_t SLA)
+{
+	// Send START + SLA+W and STOP. Returns OK if the device acknowledged (I2C_ADDR_NACK if busy)
+	int status = OK;
+	
+	// Send start
+	HAL_TWI((1<<TWINT)|(1<<TWSTA)|(1<<TWEN));
+
+	// Check the status of the interface
+	switch (TW_STATUS)
+	{
+		// Normal behavior
+		case TW_REP_START:
+		case TW_START:
+		break;
+		
+		// Lost arbitration. Should never happen
+		case TW_MT_ARB_LOST:
+		status = I2C_START_ARB_LOST;
+		goto quit;
+		
+		// Error. Should never happen. Do not send stop.
+		default:
+		return I2C_START_CRITICAL;
+	}
+	
+	// Save address in Register
+	SetRegister(memory_I2C_SLA, SLA & 0xFE);
+	
+	// Load SLA+W into TWDR Register and send
+	TWDR = SLA & 0xFE;
+	HAL_TWI((1<<TWINT) | (1<<TWEN));
+
+	// Check the status of the interface
+	switch (TW_STATUS)
+	{
+		// Address acknowledged
+		case TW_MT_SLA_ACK:
+		break;
+		
+		// Not acknowledged. Device busy.
+		case TW_MT_SLA_NACK:
+		status = I2C_ADDR_NACK;
+		break;
+		
+		// Lost arbitration. Should never happen
+		case TW_MT_ARB_LOST:
+		status = I2C_ADDR_ARB_LOST;
+		break;
+		
+		// Error.
+		default:
+		status = I2C_ADDR_CRITICAL;
+		break;
+	}
+	
+	quit:
+	// Transmit STOP condition
+	HAL_TWI_STOP();
+
+	return status;
+}
+int I2C_READ(uint8_t SLA, uint8_t * data_write, int write_len, uint8_t * data_read, int read_len)
+{
+	PROFILE_FUNCTION(PROFILE_I2C_READ);
+	//-------------------------------------------------------------------------------
+	//                                0. Initialization
+	//-------------------------------------------------------------------------------
+	// Status to be returned
+	int status = OK;
+	
+	// Number of tries
+	int n = 1;
+
+	restart:
+	if (n++ > REGISTER[memory_I2C_MAX_ITER]) {goto quit;} //The device does not respond after MAX_ITER tries
+		
+	//-------------------------------------------------------------------------------
+	//                               1. Send write command
+	//-------------------------------------------------------------------------------
+	status = I2C_WRITE(SLA, data_write, write_len);
+	if(status) return status;
+	
+
+	//-------------------------------------------------------------------------------
+	//                               2. Send RESTART
+	//-------------------------------------------------------------------------------
+	// Send start
+	HAL_TWI((1<<TWINT)|(1<<TWSTA)|(1<<TWEN));
+
+	// Check the status of the interface
+	switch (TW_STATUS)
+	{
+		// Normal behavior
+		case TW_REP_START:
+		case TW_START:
+		break;
+		
+		// Lost arbitration. Should never happen
+		case TW_MR_ARB_LOST:
+		status = I2C_RESTART_ARB_LOST;
+		goto restart;
+		
+		// Error. Should never happen. Do not send stop.
+		default:
+		return I2C_RESTART_CRITICAL;
+	}
+
+	//-------------------------------------------------------------------------------
+	//                       3. Send Device Address + Read (1)
+	//-------------------------------------------------------------------------------
+	// Save address in Register
+	SetRegister(memory_I2C_SLA, SLA);
+	
+	// Load SLA+W into TWDR Register...
+	TWDR = SLA | 0x01;
+	
+	//...and send
+	HAL_TWI((1<<TWINT) | (1<<TWEN));
+
+	//4. Check the status of the interface
+	switch (TW_STATUS)
+	{
+		// Normal behavior. Address acknowledged
+		case TW_MR_SLA_ACK:
+		//n_ack++;
+		break;
+		
+		// Not acknowledged. Device busy. Restart.
+		case TW_MR_SLA_NACK:
+		status = I2C_ADDR_NACK;
+		goto restart;
+		// Lost arbitration. Should never happen
+		case TW_MR_ARB_LOST:
+		status = I2C_ADDR_ARB_LOST;
+		goto quit;
+		
+		// Error.
+		default:
+		status = I2C_ADDR_CRITICAL;
+		goto quit;
+	}
+
+	//-------------------------------------------------------------------------------
+	//                        4. Read
+	//-------------------------------------------------------------------------------
+	for (int II=0; II < read_len; II++)
+	{
+		if(II == read_len - 1) HAL_TWI((1<<TWINT) | (1<<TWEN)); //Send NACK this time
+		else HAL_TWI((1<<TWINT) | (1<<TWEA) | (1<<TWEN));
+		
+		switch (TW_STATUS)
+		{
+			// Normal behavior. Data acknowledged
+			case TW_MR_DATA_ACK:
+			*data_read = TWDR;
+			TRACE_BYTE(TRACE_I2C | TRACE_RX, SLA | 0x01, *data_read);
+			data_read++;
+			break;
+			
+			case TW_MR_DATA_NACK:
+			II = read_len; // Force end of loop
+			*data_read = TWDR;
+			TRACE_BYTE(TRACE_I2C | TRACE_RX, SLA | 0x01, *data_read);
+			data_read++;
+			goto quit;
+						
+			// Error.
+			default:
+			status = I2C_READ_CRITICAL;
+			goto quit;
+		}
+	}
+	//-------------------------------------------------------------------------------
+	//                                   Q. Quit
+	//-------------------------------------------------------------------------------
+	quit:
+
+	//7. Transmit STOP condition
+	HAL_TWI_STOP();
+
+	return status;
+}
+
+/*--------------------------------------------------
+                       ADC
+--------------------------------------------------*/
+int ADC_INIT(unsigned long F_ADC)
+{
+	// CLOCK RATE (between 5kHz and 200kHz for good behavior)
+	SetRegister(memory_ADC_FREQ, F_ADC);
+	if (F_ADC < 5000) return ADC_CLOCK_LOW;
+	if (F_ADC > 200000) return ADC_CLOCK_HIGH;
+	
+	// Selection Register (AREF as voltage)
+	ADMUX = 0;
+	
+	// Clock prescaler
+	int prescaler = ceil(log(F_CPU/F_ADC)/log(2)); //ceil to unsure frequency less then F_ADC
+	if(prescaler>7 || prescaler<0) return ADC_CLOCK_OOB;
+	
+	// Control and status register A - Enable ADC, No trigger, No Interrupt + set clock
+	ADCSRA = (1<<ADEN) | prescaler;
+	
+	// Disable digital input (Reduce power consumption)
+	DIDR0 = (1<<PICOMOTOR_VOLTAGE) | (1<<HV_GROUND) | (1<<HV_VOLTAGE) | (1<<BUS_CURR) | (1<<BUS_VOLT) | (1<<SEP_VOLT);
+	
+	return OK;
+}
+int ADC_READ(int line, int* data)
+{
+	// Input channel selection
+	ADMUX |= line;
+	
+	// Convert
+	*data = HAL_ADC_CONVERT();
+	
+	SetRegister(memory_ADC_RX, (REGISTER[memory_ADC_RX] << 16) | (*data));
+	
+	// Reset channel selection
+	ADMUX &= ~(line);
+	
+	return OK;
+}
+
+/*--------------------------------------------------
+                       TIMER
+--------------------------------------------------*/
+volatile uint32_t TimerTicks = 0;
+
+ISR(TIMER0_COMPA_vect)
+{
+	TimerTicks++;
+}
+int TIMER_INIT(void)
+{
+	// Compare value to get TIMER_TICK_HZ
+	unsigned long top = F_CPU/TIMER_PRESCALER/TIMER_TICK_HZ - 1;
+	if(top > 255) return TIMER_CLOCK_OOB;
+	
+	// CTC mode, prescaler 64, interrupt on compare match A
+	TCCR0A = (1<<WGM01);
+	TCCR0B = (1<<CS01) | (1<<CS00);
+	OCR0A = top;
+	TIMSK0 = (1<<OCIE0A);
+	
+	sei(); // Enable interrupts
+	return OK;
+}
+uint32_t GetTicks(void)
+{
+	// 32-bit read is not atomic on the AVR
+	HAL_POLL();
+	uint8_t sreg = SREG;
+	cli();
+	uint32_t ticks = TimerTicks;
+	SREG = sreg;
+	
+	return ticks;
+}
+uint32_t GetMicros(void)
+{
+	HAL_POLL();
+	uint8_t sreg = SREG;
+	cli();
+	uint32_t ticks = TimerTicks;
+	uint8_t count = TCNT0;
+	if((TIFR0 & (1<<OCF0A)) && (count < OCR0A)) ticks++; // The counter restarted but the tick is still pending
+	SREG = sreg;
+	
+	return ticks*(1000000/TIMER_TICK_HZ) + count*(1000000/(F_CPU/TIMER_PRESCALER));
+}
@@ -0,0 +1,354 @@
+/*
+ * Memory.c
+ *
+ * Save to/load from the non-volatile memory (see Memory.h).
+ */
+
+#include "Memory.h"
+
+/*--------------------------------------------------
+                       CRC-16
+--------------------------------------------------*/
+const uint16_t CRC16_TABLE[256] PROGMEM = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+uint16_t Crc16(uint16_t crc, const uint8_t * data, uint16_t len)
+{
+	// Start with crc = 0xFFFF. Can be called several times to process data in chunks.
+	while(len--) crc = (crc << 8) ^ pgm_read_word(&CRC16_TABLE[(crc >> 8) ^ *data++]);
+	return crc;
+}
+
+/*--------------------------------------------------
+                     REGISTER 
+--------------------------------------------------*/
+int32_t REGISTER[memoryCOUNT];
+uint8_t REGISTER_DIRTY[(memoryCOUNT+7)/8];
+uint8_t RegisterSlot = 0;
+uint16_t RegisterSeq = 0;
+uint8_t JournalEpoch = JOURNAL_ERASED;
+uint16_t JournalCount = 0;
+
+void SetRegister(uint16_t index, int32_t value)
+{
+	SAVE_GUARD();
+	if(index >= memoryCOUNT) return;
+	if(index == memory_HV_STEP && value < 1) value = 1; // A null step never reaches the target of the HV ramp
+	if(REGISTER[index] == value) return;
+	
+	REGISTER[index] = value;
+	REGISTER_DIRTY[index>>3] |= (1<<(index&7));
+}
+void ClearDirtyRegister(void)
+{
+	for(int II = 0; II < (int)sizeof(REGISTER_DIRTY); II++) REGISTER_DIRTY[II] = 0;
+}
+uint16_t RegisterCrc(uint16_t seq)
+{
+	uint16_t crc = Crc16(0xFFFF, (const uint8_t*)&seq, 2);
+	return Crc16(crc, (const uint8_t*)REGISTER, memoryCOUNT*4);
+}
+uint16_t JournalRecordAddr(uint16_t record)
+{
+	uint16_t page = (JournalEpoch + record/JOURNAL_PAGE_RECORDS) % JOURNAL_PAGES;
+	return JOURNAL_ADDR + page*JOURNAL_PAGE_SIZE + (record%JOURNAL_PAGE_RECORDS)*JOURNAL_RECORD_SIZE;
+}
+int CompactRegister(void)
+{
+	SAVE_GUARD();
+	// Write the full register in the slot not in use, then start a new epoch (empty journal)
+	uint8_t slot = (JournalEpoch == JOURNAL_ERASED) ? 0 : !RegisterSlot;
+	uint16_t addr = slot*REGISTER_SLOT_SIZE;
+	
+	if(++RegisterSeq == REGISTER_SEQ_ERASED) RegisterSeq = 0;
+	
+	// The epochs repeat every 255 compactions: a record 0 left by an older use of the new epoch would be
+	// replayed after a reset. End the new journal before the snapshot is valid (not a record of the current one)
+	JournalEpoch = RegisterSeq % JOURNAL_ERASED;
+	uint8_t * first = (uint8_t*)JournalRecordAddr(0);
+	if(eeprom_read_byte(first) == JournalEpoch) eeprom_write_byte(first, JOURNAL_ERASED);
+	
+	eeprom_update_block((const void*)REGISTER, (void*)(addr + 4), memoryCOUNT*4); //*4 because the vectors are made of 32 bits int (4 bytes)
+	eeprom_update_word((uint16_t*)(addr + 2), RegisterCrc(RegisterSeq));
+	eeprom_update_word((uint16_t*)addr, RegisterSeq); // Sequence last: the slot is valid only once complete
+	
+	RegisterSlot = slot;
+	JournalCount = 0;
+	
+	ClearDirtyRegister();
+	return OK;
+}
+int SaveRegister(uint16_t eeprom_register)
+{
+	SAVE_GUARD();
+	PROFILE_FUNCTION(PROFILE_SAVE_REGISTER);
+	if(eeprom_register != 0) return INT_EEPROM_OVERLOAD;
+	
+	uint32_t start = GetMicros();
+	
+	// Count the entries that changed since the last save
+	uint16_t dirty = 0;
+	for(int II = 0; II < (int)sizeof(REGISTER_DIRTY); II++){
+		for(uint8_t bits = REGISTER_DIRTY[II]; bits; bits &= bits - 1) dirty++;
+	}
+	
+	// Statistics of the save (not marked dirty)
+	REGISTER[memory_SAVE_DIRTY_COUNT] = dirty;
+	
+	if((JournalEpoch == JOURNAL_ERASED) || (JournalCount + dirty > JOURNAL_RECORDS))
+	{
+		// No base snapshot yet or not enough space in the journal
+		CompactRegister();
+	}
+	else
+	{
+		/* Append the dirty entries to the journal */
+		for(int II = 0; II < memoryCOUNT; II++)
+		{
+			if(!REGISTER_DIRTY[II>>3]) {II |= 7; continue;} // Skip clean bytes of the bitmap
+			if(!(REGISTER_DIRTY[II>>3] & (1<<(II&7)))) continue;
+			
+			// Make sure the next record ends the journal
+			if(JournalCount + 1 < JOURNAL_RECORDS){
+				uint8_t * next = (uint8_t*)JournalRecordAddr(JournalCount + 1);
+				if(eeprom_read_byte(next) == JournalEpoch) eeprom_write_byte(next, JOURNAL_ERASED);
+			}
+			
+			// Write the record (epoch last)
+			uint16_t addr = JournalRecordAddr(JournalCount);
+			eeprom_update_dword((uint32_t*)(addr + 2), (uint32_t)REGISTER[II]);
+			eeprom_update_byte((uint8_t*)(addr + 1), (uint8_t)II);
+			eeprom_update_byte((uint8_t*)addr, JournalEpoch);
+			
+			REGISTER_DIRTY[II>>3] &= ~(1<<(II&7));
+			JournalCount++;
+		}
+	}
+	
+	REGISTER[memory_SAVE_DURATION] = GetMicros() - start;
+	return OK;
+}
+int ReadRegisterSlot(uint8_t slot, uint16_t seq)
+{
+	// Load a base snapshot to the RAM memory and check its CRC
+	uint16_t addr = slot*REGISTER_SLOT_SIZE;
+	if(seq == REGISTER_SEQ_ERASED) return INT_EEPROM_EMPTY;
+	
+	eeprom_read_block((void*)REGISTER, (const void*)(addr + 4), memoryCOUNT*4); //*4 because the vectors are made of 32 bits int (4 bytes)
+	if(eeprom_read_word((const uint16_t*)(addr + 2)) != RegisterCrc(seq)) return INT_EEPROM_CORRUPTED;
+	
+	return OK;
+}
+int LoadRegister(uint16_t eeprom_register)
+{
+	SAVE_GUARD();
+	if(eeprom_register != 0) return INT_EEPROM_OVERLOAD;
+	
+	/* Find the newest slot */
+	uint16_t seq[2];
+	seq[0] = eeprom_read_word((const uint16_t*)0);
+	seq[1] = eeprom_read_word((const uint16_t*)REGISTER_SLOT_SIZE);
+	uint8_t newest = (seq[0] == REGISTER_SEQ_ERASED) || ((seq[1] != REGISTER_SEQ_ERASED) && ((int16_t)(seq[1] - seq[0]) > 0));
+	RegisterSeq = (seq[newest] == REGISTER_SEQ_ERASED) ? 0 : seq[newest];
+	
+	/* Load the newest valid slot to the RAM memory */
+	int crc_errors = 0;
+	int fallbacks = 0;
+	RegisterSlot = newest;
+	int status = ReadRegisterSlot(newest, seq[newest]);
+	if(status == INT_EEPROM_CORRUPTED) crc_errors++;
+	if(status){
+		RegisterSlot = !newest;
+		status = ReadRegisterSlot(!newest, seq[!newest]);
+		if(status == INT_EEPROM_CORRUPTED) crc_errors++;
+		if(!status && crc_errors) fallbacks++;
+	}
+	
+	if(status){
+		// No valid snapshot (erased or both torn): start from a cleared register, the EEPROM is rewritten by the next save
+		for(int II = 0; II < memoryCOUNT; II++) REGISTER[II] = 0;
+		JournalEpoch = JOURNAL_ERASED;
+		status = INT_EEPROM_EMPTY;
+	}
+	else JournalEpoch = seq[RegisterSlot] % JOURNAL_ERASED;
+	
+	/* Replay the journal */
+	JournalCount = 0;
+	while((JournalEpoch != JOURNAL_ERASED) && (JournalCount < JOURNAL_RECORDS))
+	{
+		uint16_t addr = JournalRecordAddr(JournalCount);
+		if(eeprom_read_byte((const uint8_t*)addr) != JournalEpoch) break; // End of the journal
+		
+		uint8_t index = eeprom_read_byte((const uint8_t*)(addr + 1));
+		if(index < memoryCOUNT) REGISTER[index] = (int32_t)eeprom_read_dword((const uint32_t*)(addr + 2));
+		JournalCount++;
+	}
+	ClearDirtyRegister();
+	
+	// Count the corruptions (saved with the register)
+	if(crc_errors) SetRegister(memory_REGISTER_CRC_ERRORS, REGISTER[memory_REGISTER_CRC_ERRORS] + crc_errors);
+	if(fallbacks) SetRegister(memory_REGISTER_FALLBACKS, REGISTER[memory_REGISTER_FALLBACKS] + fallbacks);
+	
+	// Compact the journal when full
+	if(JournalCount == JOURNAL_RECORDS) CompactRegister();
+	
+	return status;
+}
+
+/*--------------------------------------------------
+                    ERROR FILE 
+--------------------------------------------------*/
+struct error_event RAM_ERROR_VECTOR[ERROR_RAM_SIZE];
+uint8_t ErrorRamCount = 0;
+uint32_t ErrorRamTick = 0;
+uint8_t ErrorHead = 0;
+uint8_t ErrorStored = 0;
+uint16_t ErrorSeq = 0;
+
+int ERROR_INIT(void)
+{
+	SAVE_GUARD();
+	// Find the most recent record in the EEPROM
+	uint16_t last = 0;
+	ErrorHead = 0;
+	ErrorStored = 0;
+	for(int II = 0; II < ERROR_VECTOR_SIZE; II++)
+	{
+		uint16_t seq = eeprom_read_word((const uint16_t*)(ERROR_VECTOR_ADDR + II*ERROR_RECORD_SIZE));
+		if(seq == ERROR_SEQ_ERASED) continue;
+		
+		if(!ErrorStored || ((int16_t)(seq - last) > 0)){
+			last = seq;
+			ErrorHead = (II + 1) % ERROR_VECTOR_SIZE;
+		}
+		ErrorStored++;
+	}
+	
+	ErrorSeq = ErrorStored ? last + 1 : 0;
+	if(ErrorSeq == ERROR_SEQ_ERASED) ErrorSeq = 0;
+	ErrorRamCount = 0;
+	
+	return OK;
+}
+int FlushErrors(void)
+{
+	SAVE_GUARD();
+	/* Write the events of the RAM to the EEPROM ring */
+	for(int II = 0; II < ErrorRamCount; II++)
+	{
+		uint16_t addr = ERROR_VECTOR_ADDR + ErrorHead*ERROR_RECORD_SIZE;
+		
+		// Invalidate the record, write the event, then the sequence number
+		eeprom_update_word((uint16_t*)addr, ERROR_SEQ_ERASED);
+		eeprom_update_dword((uint32_t*)(addr + 2), RAM_ERROR_VECTOR[II].tick);
+		eeprom_update_byte((uint8_t*)(addr + 6), RAM_ERROR_VECTOR[II].code);
+		eeprom_update_byte((uint8_t*)(addr + 7), RAM_ERROR_VECTOR[II].command);
+		eeprom_update_dword((uint32_t*)(addr + 8), (uint32_t)RAM_ERROR_VECTOR[II].data);
+		eeprom_update_word((uint16_t*)addr, ErrorSeq);
+		
+		if(++ErrorSeq == ERROR_SEQ_ERASED) ErrorSeq = 0;
+		ErrorHead = (ErrorHead + 1) % ERROR_VECTOR_SIZE;
+		if(ErrorStored < ERROR_VECTOR_SIZE) ErrorStored++;
+	}
+	ErrorRamCount = 0;
+	
+	return OK;
+}
+int SaveError(int error_code, int command, long data)
+{
+	SAVE_GUARD();
+	// Function that saves the error code and return the error code so you can call "return SaveError(some_error_code, command, data)" 
+	if(ErrorRamCount == ERROR_RAM_SIZE) FlushErrors();
+	if(ErrorRamCount == 0) ErrorRamTick = GetTicks();
+	
+	// Save
+	RAM_ERROR_VECTOR[ErrorRamCount].tick = GetTicks();
+	RAM_ERROR_VECTOR[ErrorRamCount].code = error_code;
+	RAM_ERROR_VECTOR[ErrorRamCount].command = command;
+	RAM_ERROR_VECTOR[ErrorRamCount].data = data;
+	ErrorRamCount++;
+	
+	// Count the events not read by the camera
+	SetRegister(memory_ERROR_COUNT, REGISTER[memory_ERROR_COUNT] + 1);
+	if(REGISTER[memory_ERROR_COUNT] >= ERROR_VECTOR_WARNING) SetRegister(memory_ERROR_WARNING, 1);
+	
+	return error_code;
+}
+void ErrorFileUpdate(void)
+{
+	// Lazy write of the events to the EEPROM
+	if(ErrorRamCount && (GetTicks() - ErrorRamTick >= ERROR_FLUSH_MS)) FlushErrors();
+}
+int ReadErrors(long page, uint8_t * buffer)
+{
+	SAVE_GUARD();
+	// Copy a page of records from the EEPROM ring to the buffer (oldest first). Returns the number of records.
+	// buffer must hold ERROR_PAGE_SIZE*ERROR_RECORD_SIZE bytes
+	if(page < 0) return 0;
+	
+	int oldest = (ErrorHead + ERROR_VECTOR_SIZE - ErrorStored) % ERROR_VECTOR_SIZE;
+	int count = 0;
+	for(long II = page*ERROR_PAGE_SIZE; (II < ErrorStored) && (count < ERROR_PAGE_SIZE); II++)
+	{
+		uint16_t addr = ERROR_VECTOR_ADDR + ((oldest + II) % ERROR_VECTOR_SIZE)*ERROR_RECORD_SIZE;
+		eeprom_read_block((void*)(buffer + count*ERROR_RECORD_SIZE), (const void*)addr, ERROR_RECORD_SIZE);
+		count++;
+	}
+	
+	return count;
+}
+
+/*--------------------------------------------------
+                  WATCHDOG SAVE
+--------------------------------------------------*/
+volatile uint8_t SaveInProgress = 0;
+volatile bool WatchdogSave = false;
+
+void SaveGuardEnd(uint8_t * guard)
+{
+	SaveInProgress--;
+}
+void SaveBeforeReset(void)
+{
+	FlushErrors();
+	SaveRegister(0);
+}
+void CheckWatchdogSave(void)
+{
+	// Save requested by the watchdog during a save of the main loop, once it is over
+	if(!WatchdogSave || SaveInProgress) return;
+	WatchdogSave = false;
+	SaveBeforeReset();
+}
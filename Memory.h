@@ -21,11 +21,23 @@ Instead, all the variables are saved in the RAM and sometimes, they are updated
 #define MEMORY_H_
 
 #include <avr/eeprom.h> // To save variables to non-volatile memory
+#include <avr/pgmspace.h> // To store constant tables in the flash
+#include <stdbool.h>
+#include "Profiler.h" // Cycle profiler (development builds)
 
 #ifndef OK
 #define OK 0
 #endif
 
+/*--------------------------------------------------
+                       CRC-16
+--------------------------------------------------*/
+// CRC-16/CCITT (polynomial 0x1021), one table lookup per byte. The table is stored in the flash.
+extern const uint16_t CRC16_TABLE[256] PROGMEM;
+
+// FUNCTIONS
+uint16_t Crc16(uint16_t crc, const uint8_t * data, uint16_t len);
+
 /*--------------------------------------------------
                      REGISTER 
 --------------------------------------------------*/
@@ -39,22 +51,22 @@ enum memory_enum
 	
 	/* --------------- INTERFACES ---------------- */
 	memory_USART0_BAUD,           // R
-	memory_USART0_TX,             // R
-	memory_USART0_RX,             // R
+	memory_USART0_TX,             // Unused (bus trace: Trace.h)
+	memory_USART0_RX,             // Unused (bus trace: Trace.h)
 	
 	memory_USART1_BAUD,           // R
-	memory_USART1_TX,             // R
-	memory_USART1_RX,             // R
+	memory_USART1_TX,             // Unused (bus trace: Trace.h)
+	memory_USART1_RX,             // Unused (bus trace: Trace.h)
 	
 	memory_SPI_FREQ,              // R
-	memory_SPI_TX,                // R
+	memory_SPI_TX,                // Unused (bus trace: Trace.h)
 	
 	memory_I2C_FREQ,              // R
 	memory_I2C_MAX_ITER,          // W/R
 	memory_I2C_ITER,              // R
 	memory_I2C_SLA,               // R
-	memory_I2C_TX,                // R
-	memory_I2C_RX,                // R
+	memory_I2C_TX,                // Unused (bus trace: Trace.h)
+	memory_I2C_RX,                // Unused (bus trace: Trace.h)
 	
 	memory_ADC_FREQ,              // R
 	memory_ADC_RX,				  // R
@@ -163,63 +175,182 @@ enum memory_enum
 	memory_ELECTRODE40,           // W/R     //NOT IMPLEMENTED
 	memory_ELECTRODE41,           // W/R     //NOT IMPLEMENTED
 	memory_ELECTRODE42,           // W/R     //NOT IMPLEMENTED
+	
+	/* ---------------- HV RAMP ------------------ */
+	memory_HV_SLEW_MS,            // W/R
+	memory_HV_RAMP_STATE,         // R
+	memory_HV_RAMP_TIMEOUTS,      // R
+	
+	/* ----------------- MEMORY ------------------ */
+	memory_SAVE_DIRTY_COUNT,      // R
+	memory_SAVE_DURATION,         // R
+	memory_REGISTER_CRC_ERRORS,   // R
+	memory_REGISTER_FALLBACKS,    // R
+	memory_ERROR_COUNT,           // R
+	memory_ERROR_WARNING,         // R
+	
+	/* -------------- COMMUNICATION -------------- */
+	memory_FRAMING0,              // W/R
+	memory_FRAMING1,              // W/R
+	memory_FRAME_ERRORS0,         // R
+	memory_FRAME_ERRORS1,         // R
+	memory_REPLAYS0,              // R
+	memory_REPLAYS1,              // R
+	memory_RX_LATENCY0,           // R
+	memory_RX_LATENCY1,           // R
+	memory_RX_LATENCY_MAX0,       // W/R
+	memory_RX_LATENCY_MAX1,       // W/R
+	memory_COMMAND_LATENCY,       // R
+	memory_COMMAND_LATENCY_MAX,   // W/R
+	
+	/* ------------------ USART ------------------ */
+	memory_USART0_BAUD_ERROR,     // R
+	memory_USART1_BAUD_ERROR,     // R
+	
+	/* ------------------ XBEE ------------------- */
+	memory_XBEE_API,              // R (mode set by command 158, used at boot)
+	memory_XBEE_RO,               // R
+	memory_XBEE_TX_FAILS,         // R
+	memory_XBEE_RX_ERRORS,        // R
 
 	memoryCOUNT //To count the number of variables to memorize
 };
 
+/*
+The register is saved as a journal to spread the EEPROM wear:
+- Two base snapshot slots (A/B) hold a full copy of the register, a sequence number and a CRC-16.
+  Each compaction writes the slot that is not in use, so a torn write never destroys the last good snapshot.
+- The journal holds (epoch, index, value) records of the entries that changed since the base snapshot.
+  Records are appended through JOURNAL_PAGES pages. The first page of the journal rotates with the epoch.
+- When the journal is full, the register is compacted into the other base snapshot with the next sequence number.
+  The epoch is derived from the sequence number, so all the records are invalidated at once.
+A record is valid only if its epoch matches the base snapshot. The epoch byte is written last,
+so a save interrupted by a reset leaves an invalid record which ends the journal.
+
+At boot, the newest slot with a valid CRC is loaded and its journal is replayed.
+If it is corrupted, the other slot is used (without the journal of the corrupted one).
+
+All the writes to the register go through SetRegister(), which marks the modified entries in a dirty bitmap.
+A save only journals the dirty entries, so its duration does not depend on the size of the register.
+Worst case (all entries dirty or compaction) is about memoryCOUNT*20ms, well within the 8s watchdog reset window.
+*/
+
 // VECTORS DECLARATION
-int32_t REGISTER[memoryCOUNT]; //Register vector in the RAM
+extern int32_t REGISTER[memoryCOUNT]; //Register vector in the RAM
+extern uint8_t REGISTER_DIRTY[(memoryCOUNT+7)/8]; //One bit per entry modified since the last save
 
 // PARAMETERS
 #define INT_EEPROM_MAX_ADDR 4096
+#define REGISTER_SLOT_SIZE 640 // Size of a base snapshot slot: sequence (2) + CRC (2) + register
+#define REGISTER_SEQ_ERASED 0xFFFF // Sequence number of an erased slot
+#define JOURNAL_ADDR 1280 // First page of the journal (after the two slots)
+#define JOURNAL_PAGES 4 // Number of pages in the journal
+#define JOURNAL_PAGE_SIZE 256 // Bytes per page
+#define JOURNAL_RECORD_SIZE 6 // epoch (1) + index (1) + value (4)
+#define JOURNAL_PAGE_RECORDS (JOURNAL_PAGE_SIZE/JOURNAL_RECORD_SIZE) // Records per page
+#define JOURNAL_RECORDS (JOURNAL_PAGES*JOURNAL_PAGE_RECORDS) // Records in the journal
+#define JOURNAL_ERASED 0xFF // Epoch of an erased EEPROM
+
+// The register must fit in a slot
+typedef char register_slot_check[(4 + memoryCOUNT*4 <= REGISTER_SLOT_SIZE) ? 1 : -1];
 
 // ENUM
 enum int_eeprom{
-	INT_EEPROM_OVERLOAD = 1
+	INT_EEPROM_OVERLOAD = 1,
+	INT_EEPROM_EMPTY,
+	INT_EEPROM_CORRUPTED
 	};
 
+// VARIABLES
+extern uint8_t RegisterSlot; // Slot of the current base snapshot
+extern uint16_t RegisterSeq; // Highest sequence number found in the slots
+extern uint8_t JournalEpoch; // Epoch of the base snapshot
+extern uint16_t JournalCount; // Number of valid records in the journal
+
+// PROTOTYPES
+uint32_t GetTicks(void); // Interfaces.h
+uint32_t GetMicros(void); // Interfaces.h
+
 // FUNCTIONS
-int SaveRegister(uint16_t eeprom_register)
-{
-	if(eeprom_register*memoryCOUNT*4 + memoryCOUNT*4 - 1 > INT_EEPROM_MAX_ADDR) return INT_EEPROM_OVERLOAD;
-	
-	/* Update the EEPROM memory with the current RAM memory */
-	eeprom_update_block((const void*)REGISTER, (void*)(eeprom_register*memoryCOUNT*4), memoryCOUNT*4); //*4 because the vectors are made of 32 bits int (4 bytes)
-	return OK;
-}
-int LoadRegister(uint16_t eeprom_register)
-{
-	if(eeprom_register*memoryCOUNT*4 + memoryCOUNT*4 - 1 > INT_EEPROM_MAX_ADDR) return INT_EEPROM_OVERLOAD;
-	
-	/* Load the EEPROM memory to the RAM memory */
-	eeprom_read_block((void*)REGISTER, (const void*)(eeprom_register*memoryCOUNT*4), memoryCOUNT*4); //*4 because the vectors are made of 32 bits int (4 bytes)
-	return OK;
-}
+void SetRegister(uint16_t index, int32_t value);
+void ClearDirtyRegister(void);
+uint16_t RegisterCrc(uint16_t seq);
+uint16_t JournalRecordAddr(uint16_t record);
+int CompactRegister(void);
+int SaveRegister(uint16_t eeprom_register);
+int ReadRegisterSlot(uint8_t slot, uint16_t seq);
+int LoadRegister(uint16_t eeprom_register);
 
 /*--------------------------------------------------
                     ERROR FILE 
 --------------------------------------------------*/
-/*#define ERROR_VECTOR_SIZE 100 //100 lines in the error file
-#define ERROR_VECTOR_WARNING 90 //When the file reached 90 lines, a warning is sent to the camera CPU
-int ErrorCount = 0;
+/*
+Errors are logged as events: (tick, error code, command, data).
+They are first stored in the RAM, then written lazily to a ring in the EEPROM (ErrorFileUpdate, called from the main loop).
+SaveError and FlushErrors share the indexes without protection: they are called from the main loop only, never from an interrupt
+(the save before the watchdog reset is done from the interrupt outside of them, see WATCHDOG SAVE).
+Each EEPROM record starts with a sequence number, written last, which gives the most recent event at boot.
+The camera reads the events by pages of ERROR_PAGE_SIZE events (command 242).
+*/
+
+// PARAMETERS
+#define ERROR_VECTOR_SIZE 100 //100 lines in the error file
+#define ERROR_VECTOR_WARNING 90 //When 90 lines have not been read, a warning is raised in the register
+#define ERROR_VECTOR_ADDR (JOURNAL_ADDR + JOURNAL_PAGES*JOURNAL_PAGE_SIZE) // After the register journal
+#define ERROR_RECORD_SIZE 12 // seq (2) + tick (4) + code (1) + command (1) + data (4)
+#define ERROR_SEQ_ERASED 0xFFFF // Sequence number of an erased record
+#define ERROR_RAM_SIZE 16 // Events kept in the RAM before writing to the EEPROM
+#define ERROR_FLUSH_MS 10000 // Maximum time an event stays in the RAM [ms]
+#define ERROR_PAGE_SIZE 8 // Events per page read by the camera
+
+// The error file must fit in the EEPROM
+typedef char error_vector_check[(ERROR_VECTOR_ADDR + ERROR_VECTOR_SIZE*ERROR_RECORD_SIZE <= INT_EEPROM_MAX_ADDR) ? 1 : -1];
+
+struct error_event{
+	uint32_t tick;
+	uint8_t code;
+	uint8_t command;
+	int32_t data;
+};
 
 // VECTORS DECLARATION
-uint32_t EEMEM	EEPROM_ERROR_VECTOR[ERROR_VECTOR_SIZE];
-uint32_t RAM_ERROR_VECTOR[ERROR_VECTOR_SIZE];
+extern struct error_event RAM_ERROR_VECTOR[ERROR_RAM_SIZE];
+
+// VARIABLES
+extern uint8_t ErrorRamCount; // Events in the RAM
+extern uint32_t ErrorRamTick; // Tick of the oldest event in the RAM
+extern uint8_t ErrorHead; // Next record of the EEPROM ring
+extern uint8_t ErrorStored; // Records in the EEPROM ring
+extern uint16_t ErrorSeq; // Sequence number of the next record
 
 // FUNCTIONS
-int SaveError(int error_code)
-{
-	// Function that saves the error code and return the error code so you can call "return SaveError(some_error_code)" 
-	
-	// Get time??
-	
-	// Save
-	RAM_ERROR_VECTOR[ErrorCount] = error_code;	
-	ErrorCount++;
-	
-	return error_code;
-}
+int ERROR_INIT(void);
+int FlushErrors(void);
+int SaveError(int error_code, int command, long data);
+void ErrorFileUpdate(void);
+int ReadErrors(long page, uint8_t * buffer);
+
+/*--------------------------------------------------
+                  WATCHDOG SAVE
+--------------------------------------------------*/
+/*
+The watchdog interrupt (WDT_vect in main.c) saves the errors and the register 8s before the reset by the watchdog.
+It saves from the interrupt, because the main loop can be blocked longer in a command (upload 245, update 249, picomotor moves).
+The functions of this file that write the register, the error file or the EEPROM are not reentrant: they hold SaveInProgress
+(SAVE_GUARD), and an interrupt during one of them only requests the save (WatchdogSave). The request is served by
+CheckWatchdogSave, called by the main loop and by the blocking waits (byte reception, EEPROM write cycle, picomotor moves).
 */
 
+// VARIABLES
+extern volatile uint8_t SaveInProgress; // Functions holding the guard (nested calls)
+extern volatile bool WatchdogSave; // Save requested by the watchdog during a guarded function
+
+// FUNCTIONS
+void SaveGuardEnd(uint8_t * guard);
+void SaveBeforeReset(void);
+void CheckWatchdogSave(void);
+
+// Guard over the rest of the function (released by the cleanup of the variable when it returns)
+#define SAVE_GUARD() uint8_t save_guard __attribute__((cleanup(SaveGuardEnd))) = SaveInProgress++
+
 #endif /* MEMORY_H_ */
\ No newline at end of file
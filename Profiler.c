@@ -0,0 +1,89 @@
+/*
+ * Profiler.c
+ *
+ * Cycle profiler, development builds only (see Profiler.h).
+ */
+
+#include "Profiler.h"
+
+#ifdef PROFILE
+
+/*--------------------------------------------------
+                      TABLE
+--------------------------------------------------*/
+struct profile_entry ProfileTable[PROFILE_REGIONS];
+volatile uint16_t ProfileOverflows = 0;
+
+ISR(TIMER1_OVF_vect)
+{
+	ProfileOverflows++;
+}
+void ProfileReset(void)
+{
+	for(int II = 0; II < PROFILE_REGIONS; II++){
+		ProfileTable[II].count = 0;
+		ProfileTable[II].total = 0;
+		ProfileTable[II].min = UINT32_MAX;
+		ProfileTable[II].max = 0;
+	}
+}
+void PROFILER_INIT(void)
+{
+	// Timer1 in normal mode at F_CPU, interrupt on overflow
+	TCCR1A = 0;
+	TCCR1B = (1<<CS10);
+	TCNT1 = 0;
+	TIMSK1 = (1<<TOIE1);
+	ProfileReset();
+}
+uint32_t ProfileCycles(void)
+{
+	// 32-bit cycle counter (the overflow may be pending while the interrupts are disabled)
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t count = HAL_TIMER1_COUNT();
+	uint16_t high = ProfileOverflows;
+	if((TIFR1 & (1<<TOV1)) && (count < 0x8000)) high++;
+	SREG = sreg;
+
+	return ((uint32_t)high << 16) | count;
+}
+void ProfileRecord(uint8_t region, uint32_t start)
+{
+	uint32_t cycles = ProfileCycles() - start;
+	struct profile_entry * entry = &ProfileTable[region];
+
+	if(entry->count < UINT16_MAX) entry->count++;
+	entry->total = (entry->total > UINT32_MAX - cycles) ? UINT32_MAX : entry->total + cycles;
+	if(cycles < entry->min) entry->min = cycles;
+	if(cycles > entry->max) entry->max = cycles;
+}
+int ProfileDump(uint8_t * buffer, bool reset)
+{
+	// Table as PROFILE_REGIONS records (MSB first), in the order of enum profile_region. Returns the number of bytes
+	for(int II = 0; II < PROFILE_REGIONS; II++){
+		struct profile_entry * entry = &ProfileTable[II];
+		uint32_t min = entry->count ? entry->min : 0;
+		uint8_t * record = buffer + II*PROFILE_RECORD_SIZE;
+		record[0] = entry->count >> 8;
+		record[1] = entry->count;
+		for(int JJ = 0; JJ < 4; JJ++){
+			record[2 + JJ] = entry->total >> 8*(3 - JJ);
+			record[6 + JJ] = min >> 8*(3 - JJ);
+			record[10 + JJ] = entry->max >> 8*(3 - JJ);
+		}
+	}
+	if(reset) ProfileReset();
+
+	return PROFILE_REGIONS*PROFILE_RECORD_SIZE;
+}
+
+/*--------------------------------------------------
+                      MACROS
+--------------------------------------------------*/
+void ProfileMarkEnd(struct profile_mark * mark)
+{
+	ProfileRecord(mark->region, mark->start);
+}
+
+#endif /* PROFILE */
@@ -0,0 +1,91 @@
+/*
+ * Profiler.h
+ *
+ * CYCLE PROFILER (development builds only)
+ *
+ * Compiled in when PROFILE is defined (-DPROFILE). Flight builds do not define it: the macros are then empty
+ * and nothing of the profiler is left in the code (no timer, no table, no command).
+ *
+ * Timer1 counts the CPU cycles (no prescaler). Its overflow interrupt extends it to 32 bits (536 s at 8 MHz).
+ * A region is measured from PROFILE_BEGIN to PROFILE_END in the same block, or over a whole function with
+ * PROFILE_FUNCTION at its top (measured until the function returns, whatever the return).
+ * Each region keeps its count, total, minimum and maximum number of cycles. The cycles include the interrupts
+ * that happened in the region and the reading of the timer (about 30 cycles).
+ * The table is sent and reset by command 232 (see ProfileDump).
+ */
+
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#ifdef PROFILE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "Hal.h"
+
+/*--------------------------------------------------
+                      REGIONS
+--------------------------------------------------*/
+enum profile_region{
+	PROFILE_PARSE_COMMAND,
+	PROFILE_MOVE_PICOMOTOR,
+	PROFILE_MOVE_INTERVALS,
+	PROFILE_ENCODER_STATE,
+	PROFILE_ACTUATE_ELECTRODE,
+	PROFILE_SAVE_REGISTER,
+	PROFILE_SPI_WRITE,
+	PROFILE_I2C_WRITE,
+	PROFILE_I2C_READ,
+	PROFILE_REGIONS // Number of regions
+	};
+
+#define PROFILE_RECORD_SIZE 14 // Bytes per region in the dump: count (2), total (4), min (4), max (4)
+
+/*--------------------------------------------------
+                      TABLE
+--------------------------------------------------*/
+struct profile_entry{
+	uint16_t count; // Number of measures (saturates)
+	uint32_t total; // Cycles of all the measures (saturates)
+	uint32_t min;
+	uint32_t max;
+};
+extern struct profile_entry ProfileTable[PROFILE_REGIONS];
+
+extern volatile uint16_t ProfileOverflows; // High word of the cycle counter
+
+// FUNCTIONS
+void ProfileReset(void);
+void PROFILER_INIT(void);
+uint32_t ProfileCycles(void);
+void ProfileRecord(uint8_t region, uint32_t start);
+int ProfileDump(uint8_t * buffer, bool reset);
+
+/*--------------------------------------------------
+                      MACROS
+--------------------------------------------------*/
+// Region measured over the rest of the function (recorded by the cleanup of the variable when it returns)
+struct profile_mark{
+	uint8_t region;
+	uint32_t start;
+};
+void ProfileMarkEnd(struct profile_mark * mark);
+#define PROFILE_FUNCTION(region) struct profile_mark profile_mark __attribute__((cleanup(ProfileMarkEnd))) = {region, ProfileCycles()}
+
+// Region measured between two points of the same block
+#define PROFILE_BEGIN(region) uint32_t profile_start_##region = ProfileCycles()
+#define PROFILE_END(region) ProfileRecord(region, profile_start_##region)
+
+#else
+
+#define PROFILER_INIT()
+#define PROFILE_FUNCTION(region)
+#define PROFILE_BEGIN(region)
+#define PROFILE_END(region)
+
+#endif /* PROFILE */
+
+#endif /* PROFILER_H_ */
@@ -0,0 +1,69 @@
+/*
+ * Trace.c
+ *
+ * Bus trace, development builds only (see Trace.h).
+ */
+
+#include "Trace.h"
+
+#ifdef TRACE
+
+/*--------------------------------------------------
+                       RING
+--------------------------------------------------*/
+struct trace_record TraceRing[TRACE_SIZE];
+volatile uint8_t TraceHead = 0;
+volatile uint16_t TraceCount = 0;
+volatile uint16_t TraceLost = 0;
+volatile bool TraceSuspended = false;
+
+void TraceRecord(uint8_t bus, uint8_t address, uint8_t byte)
+{
+	if(TraceSuspended) return;
+	uint32_t time = GetMicros();
+
+	uint8_t sreg = SREG;
+	cli();
+	struct trace_record * record = &TraceRing[TraceHead];
+	record->time = time;
+	record->bus = bus;
+	record->address = address;
+	record->byte = byte;
+	TraceHead = (TraceHead + 1) & (TRACE_SIZE - 1);
+	if(TraceCount < TRACE_SIZE) TraceCount++;
+	else if(TraceLost < UINT16_MAX) TraceLost++;
+	SREG = sreg;
+}
+void TraceClear(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	TraceCount = 0;
+	TraceLost = 0;
+	SREG = sreg;
+}
+int TraceRead(uint8_t * buffer, uint16_t * lost)
+{
+	// Up to TRACE_READ_MAX oldest records (MSB first), removed from the ring. Returns the number of records
+	// lost = records overwritten since the previous read
+	uint8_t sreg = SREG;
+	cli();
+	int n = (TraceCount < TRACE_READ_MAX) ? TraceCount : TRACE_READ_MAX;
+	uint8_t tail = (TraceHead - TraceCount) & (TRACE_SIZE - 1);
+	for(int II = 0; II < n; II++){
+		struct trace_record * entry = &TraceRing[(tail + II) & (TRACE_SIZE - 1)];
+		uint8_t * record = buffer + II*TRACE_RECORD_SIZE;
+		for(int JJ = 0; JJ < 4; JJ++) record[JJ] = entry->time >> 8*(3 - JJ);
+		record[4] = entry->bus;
+		record[5] = entry->address;
+		record[6] = entry->byte;
+	}
+	TraceCount -= n;
+	*lost = TraceLost;
+	TraceLost = 0;
+	SREG = sreg;
+
+	return n;
+}
+
+#endif /* TRACE */
@@ -0,0 +1,78 @@
+/*
+ * Trace.h
+ *
+ * BUS TRACE (development builds only)
+ *
+ * Compiled in when TRACE is defined (-DTRACE). Otherwise TRACE_BYTE is empty and nothing of the trace is left
+ * in the code (no buffer, no command).
+ *
+ * Every byte written or read on USART0, USART1, SPI and I2C is recorded with its time (GetMicros), its bus,
+ * its direction and its address (SPI select line or I2C SLA) in a ring buffer of TRACE_SIZE records.
+ * When the ring is full the oldest records are overwritten and counted as lost.
+ * The records are read (and removed) in bulk by command 234, oldest first (see TraceRead).
+ * The reply of command 234 is not traced.
+ */
+
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#ifdef TRACE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "Hal.h"
+
+/*--------------------------------------------------
+                       BUSES
+--------------------------------------------------*/
+enum trace_bus{
+	TRACE_USART0,
+	TRACE_USART1,
+	TRACE_SPI,
+	TRACE_I2C
+	};
+
+#define TRACE_TX 0x00
+#define TRACE_RX 0x80 // Direction bit of the bus field
+
+#ifndef TRACE_SIZE
+#define TRACE_SIZE 128 // Records in the ring (power of 2, 256 at most)
+#endif
+#define TRACE_RECORD_SIZE 7 // Bytes per record in a read: time (4), bus | direction (1), address (1), byte (1)
+#define TRACE_READ_MAX 22 // Records per read (fits a frame)
+
+/*--------------------------------------------------
+                       RING
+--------------------------------------------------*/
+struct trace_record{
+	uint32_t time; // [us]
+	uint8_t bus; // enum trace_bus | TRACE_TX or TRACE_RX
+	uint8_t address;
+	uint8_t byte;
+};
+extern struct trace_record TraceRing[TRACE_SIZE];
+
+extern volatile uint8_t TraceHead; // Next record written
+extern volatile uint16_t TraceCount; // Records in the ring
+extern volatile uint16_t TraceLost; // Records overwritten before being read (saturates)
+extern volatile bool TraceSuspended;
+
+uint32_t GetMicros(void); // Interfaces.h
+
+// FUNCTIONS
+void TraceRecord(uint8_t bus, uint8_t address, uint8_t byte);
+void TraceClear(void);
+int TraceRead(uint8_t * buffer, uint16_t * lost);
+
+#define TRACE_BYTE(bus, address, byte) TraceRecord(bus, address, byte)
+
+#else
+
+#define TRACE_BYTE(bus, address, byte)
+
+#endif /* TRACE */
+
+#endif /* TRACE_H_ */
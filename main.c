@@ -5,8 +5,6 @@
  * Author : Thibaud
  */ 
 
-#define F_CPU 8000000UL // CPU Frequency (IMPORTANT)
-
 #include "Memory.h"
 #include "Interfaces.h"
 #include "Drivers.h"
@@ -14,13 +12,14 @@
 
 int ParseCommand(int port)
 {
+	PROFILE_FUNCTION(PROFILE_PARSE_COMMAND);
 	/*--------------------------------------------------
                        MESSAGE CHECK
 	--------------------------------------------------*/
 	int II;
 	
-	// Checksum
-	if(MessageChecksumN)
+	// Checksum (COBS frames are already checked with their CRC-16)
+	if(MessageChecksumN && !IsFramed(port))
 	{
 		unsigned int sum = 0;
 		for(II = 0; II < MessageN-MessageChecksumN; II++) sum += Message[II];
@@ -35,6 +34,7 @@ int ParseCommand(int port)
 		
 		if(checksum != mask)
 		{
+			SaveError(COMMUNICATION_CHECKSUM,Message[0],checksum);
 			int error = SendFeedback(port,'C',checksum);
 			if(error) return error;
 		}
@@ -65,7 +65,7 @@ int ParseCommand(int port)
 	// command = 1-149
 	else if (command < 150)
 	{	
-		REGISTER[command] = data;
+		SetRegister(command, data);
 		int error = SendFeedback(port,command,0);
 		if(error) return error;	
 	}
@@ -87,119 +87,141 @@ int ParseCommand(int port)
 	// RE-INITIALIZE USART0
 	else if (command==151){
 		int status = USART0_INIT(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RE-INITIALIZE USART1
 	else if (command==152){
 		int status = USART1_INIT(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RE-INITIALIZE SPI
 	else if (command==153){
 		int status = SPI_INIT(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RE-INITIALIZE I2C
 	else if (command==154){
 		int status = I2C_INIT(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RE-INITIALIZE ADC
 	else if (command==155){
 		int status = ADC_INIT(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RE-INITIALIZE COMMUNICATIONS
 	else if (command==156){
 		int status = COMMUNICATION_INIT(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
+		if(error) return error;
+	}
+	
+	// RE-INITIALIZE TIMER
+	else if (command==157){
+		int status = TIMER_INIT();
+		int error = SendStatus(port,command,status,data);
+		if(error) return error;
+	}
+	
+	// RE-INITIALIZE XBEE (data = baud rate, + 1 << XBEE_API_BIT for the API mode: radio configured with AP = 2)
+	else if (command==158){
+		int status = XBEE_INIT((data >> XBEE_API_BIT) & 1, data & ((1L << XBEE_API_BIT) - 1));
+		int error = SendStatus(port,command,status,data);
+		if(error) return error;
+	}
+	
+	// SET XBEE PACKETIZATION TIMEOUT (data = number of character times)
+	else if (command==159){
+		int status = XBeeSetPacketTimeout(data);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RE-INITIALIZE POWER
 	else if (command==160){
 		int status = POWER_INIT();
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// ACTIVATE ELECTRODE HV
 	else if (command==161){
 		int status = ActivateHV();
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// DEACTIVATE ELECTRODE HV
 	else if (command==162){
+		HVRampStop();
 		int status = DeactivateHV();
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// ACTIVATE PICOMOTOR HV
 	else if (command==163){
 		int status = ActivatePICOV(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// DEACTIVATE PICOMOTOR HV
 	else if (command==164){
 		int status = DeactivatePICOV();
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// CHANGE VARIABLE HV
 	else if (command==165){
 		int status = SetVoltage(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// CHANGE BIAS HV
 	else if (command==166){
 		int status = SetBias(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// ENABLE SUPPLY VOLTAGE
 	else if (command==167){
 		int status = EnableSV(data,true);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// DISABLE SUPPLY VOLTAGE
 	else if (command==168){
 		int status = EnableSV(data,false);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// ENABLE CURRENT LIMITER
 	else if (command==169){
 		int status = EnableCL(data,true);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// DISABLE CURRENT LIMITER
 	else if (command==170){
 		int status = EnableCL(data,false);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
@@ -207,7 +229,7 @@ int ParseCommand(int port)
 	else if (command==171){
 		int val;
 		int status = MeasureV(data,&val);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
@@ -221,14 +243,14 @@ int ParseCommand(int port)
 	// RE-INITIALIZE SEPERATION DEVICE
 	else if (command==175){
 		int status = SEP_DEV_INIT();
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RELEASE SEPERATION DEVICE
 	else if (command==176){
 		int status = ReleaseMirror(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
@@ -242,172 +264,172 @@ int ParseCommand(int port)
 	// RE-INITIALIZE PICOMOTORS DRIVER
 	else if (command==179){
 		int status = PICOMOTORS_INIT();
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RE-INITIALIZE PICOMOTORS ESTIMATION ALGORITHM
 	else if (command==180){
 		int status = PICOMOTOR_ESTIMATION_INIT(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// LEFT PICOMOTOR
 	else if(command==181){ // MOVE BY TICKS
 		int status = MovePicomotor(0,data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==182){ // MOVE BY INTERVALS
 		int MovedIntervals, MovedTicks;
 		int status = MoveIntervals(0, data, &MovedIntervals, &MovedTicks);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==183){ // MOVE BY NM (THROUGH ALGORITHM)
 		int status = SetPicomotorLocation(0, REGISTER[memory_PICO0_LOCATION], data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==184){ // INITIALIZE
 		int status = InitializePicomotor(0, data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==185){ // CALIBRATE
 		float mean, std;
 		int status = CalibratePicomotor(0, data, &mean, &std);
 		if(!status){
-			REGISTER[memory_PICO0_MEAN] =  (long)(mean*1000000);
-			REGISTER[memory_PICO0_STD] =  (long)(  std*1000000);
+			SetRegister(memory_PICO0_MEAN, (long)(mean*1000000));
+			SetRegister(memory_PICO0_STD, (long)(  std*1000000));
 		}
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==186){ // MEASURE ENCODER STATE
 		int state;
 		int status = GetEncoderState(0, &state);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RIGHT PICOMOTOR
 	else if(command==191){ // MOVE BY TICKS
 		int status = MovePicomotor(1,data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==192){ // MOVE BY INTERVALS
 		int MovedIntervals, MovedTicks;
 		int status = MoveIntervals(1, data, &MovedIntervals, &MovedTicks);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==193){ // MOVE BY NM (THROUGH ALGORITHM)
 		int status = SetPicomotorLocation(1, REGISTER[memory_PICO1_LOCATION], data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==194){ // INITIALIZE
 		int status = InitializePicomotor(1, data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==195){ // CALIBRATE
 		float mean, std;
 		int status = CalibratePicomotor(1, data, &mean, &std);
 		if(!status){
-			REGISTER[memory_PICO1_MEAN] =  (long)(mean*1000000);
-			REGISTER[memory_PICO1_STD] =  (long)(std*1000000);
+			SetRegister(memory_PICO1_MEAN, (long)(mean*1000000));
+			SetRegister(memory_PICO1_STD, (long)(std*1000000));
 		}
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==196){ // MEASURE ENCODER STATE
 		int state;
 		int status = GetEncoderState(1, &state);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// BOTTOM PICOMOTOR
 	else if(command==201){ // MOVE BY TICKS
 		int status = MovePicomotor(2,data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==202){ // MOVE BY INTERVALS
 		int MovedIntervals, MovedTicks;
 		int status = MoveIntervals(2, data, &MovedIntervals, &MovedTicks);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==203){ // MOVE BY NM (THROUGH ALGORITHM)
 		int status = SetPicomotorLocation(2, REGISTER[memory_PICO2_LOCATION], data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==204){ // INITIALIZE
 		int status = InitializePicomotor(2, data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==205){ // CALIBRATE
 		float mean, std;
 		int status = CalibratePicomotor(2, data, &mean, &std);
 		if(!status) {
-			REGISTER[memory_PICO2_MEAN] = (long)(mean*1000000);
-			REGISTER[memory_PICO2_STD] =  (long)(std*1000000);
+			SetRegister(memory_PICO2_MEAN, (long)(mean*1000000));
+			SetRegister(memory_PICO2_STD, (long)(std*1000000));
 		}
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	else if(command==206){ // MEASURE ENCODER STATE
 		int state;
 		int status = GetEncoderState(2, &state);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RE-INITIALIZE MUX
 	else if (command==210){
 		int status = MULTIPLEXER_INIT(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// TURN CHANNEL ON
 	else if (command==211){ 
 		int status = ChannelOn(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	// TURN CHANNEL OFF
 	else if (command==212){ 
 		int status = ChannelOff(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RE-INITIALIZE ELECTRODE ALGORITHM
 	else if (command==213){
 		int status = ELECTRODE_ACTUATION_INIT();
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// ACTUATE ELECTRODE
 	else if (command==214){
 		int status = ActuateElectode(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RE-INITIALIZE THERMO-SENSORS
 	else if (command==220){
 		int status = TEMP_SENSORS_INIT();
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
@@ -415,7 +437,7 @@ int ParseCommand(int port)
 	else if(command==221){
 		int16_t temp;
 		int status = GetTemperatureMCP9801(data, &temp);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
@@ -423,14 +445,14 @@ int ParseCommand(int port)
 	else if(command==222){
 		int16_t temp;
 		int status = GetTemperatureTMP006(data, &temp);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
 	// RE-INITIALIZE WATCHDOG TIMER
 	else if (command==230){
 		int status = WATCHDOG_INIT();
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
@@ -441,6 +463,58 @@ int ParseCommand(int port)
 		if(error) return error;
 	}
 	
+	// READ COMMAND LATENCY HISTOGRAM (data = class, + 0x100 to clear it after the read, 0x1FF clears all the classes)
+	else if (command==233){
+		int latency_class = data & 0xff;
+		if(data == 0x1ff){
+			ResetLatency(LATENCY_CLASSES);
+			int error = SendFeedback(port,command,0);
+			if(error) return error;
+		}
+		else if(latency_class >= LATENCY_CLASSES){
+			int error = SendStatus(port,command,COMMUNICATION_LATENCY_CLASS,data);
+			if(error) return error;
+		}
+		else{
+			uint8_t histogram[2*LATENCY_BUCKETS];
+			int len = ReadLatency(latency_class, histogram);
+			if(data & 0x100) ResetLatency(latency_class);
+			int error = SendFeedback(port,command,LATENCY_BUCKETS);
+			if(error) return error;
+			error = SendBytes(port, histogram, len);
+			if(error) return error;
+		}
+	}
+	
+#ifdef PROFILE
+	// READ PROFILER (then reset it, unless data = 1)
+	else if (command==232){
+		uint8_t table[PROFILE_REGIONS*PROFILE_RECORD_SIZE];
+		int len = ProfileDump(table, data != 1);
+		int error = SendFeedback(port,command,PROFILE_REGIONS);
+		if(error) return error;
+		error = SendBytes(port, table, len);
+		if(error) return error;
+	}
+#endif
+	
+#ifdef TRACE
+	// READ BUS TRACE (oldest records, removed from the trace. data = 1 clears the trace)
+	// Feedback data = records lost since the previous read << 16 | number of records, followed by the records
+	else if (command==234){
+		uint8_t records[TRACE_READ_MAX*TRACE_RECORD_SIZE];
+		uint16_t lost = 0;
+		int n = 0;
+		if(data == 1) TraceClear();
+		else n = TraceRead(records, &lost);
+		TraceSuspended = true; // The reply is not traced
+		int error = SendFeedback(port,command,((int32_t)lost << 16) | n);
+		if(!error && n) error = SendBytes(port, records, n*TRACE_RECORD_SIZE);
+		TraceSuspended = false;
+		if(error) return error;
+	}
+#endif
+	
 	/*--------------------------------------------------
                        SPECIAL COMMANDS
 	--------------------------------------------------*/
@@ -449,30 +523,63 @@ int ParseCommand(int port)
 	// SAVE MEMORY
 	else if(command==240){
 		int status = SaveRegister(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 
 	// LOAD MEMORY
 	else if(command==241){
 		int status = LoadRegister(data);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
+		if(error) return error;
+	}
+	
+	// READ ERROR FILE (one page of events, oldest first)
+	else if(command==242){
+		int status = FlushErrors();
+		if(status){
+			int error = SendStatus(port,command,status,data);
+			if(error) return error;
+		}
+		else{
+			uint8_t events[ERROR_PAGE_SIZE*ERROR_RECORD_SIZE];
+			int count = ReadErrors(data, events);
+			int error = SendFeedback(port,command,count);
+			if(error) return error;
+			error = SendBytes(port, events, count*ERROR_RECORD_SIZE);
+			if(error) return error;
+		}
+	}
+	
+	// CLEAR ERROR FILE WARNING
+	else if(command==243){
+		SetRegister(memory_ERROR_COUNT, 0);
+		SetRegister(memory_ERROR_WARNING, 0);
+		int error = SendFeedback(port,command,0);
 		if(error) return error;
 	}
 	
-	// WRITE CODE TO EEPROM
+	// WRITE CODE TO EEPROM (streamed by chunks, see UploadCodeinEEPROM)
 	else if(command==245){
 		uint16_t length = data & 0xffff;
 		uint32_t eeprom_index = data >> 16;
-		uint8_t buffer[length + 2];
-		buffer[0] = length >> 8;
-		buffer[1] = length;
 		int error = SendFeedback(port,command,0);
 		if(error) return error;	
 		
-		int status = LoadMessage(port, &(buffer[2]), length,(long)10000);
-		if(status==0) status = WriteinEEPROM(eeprom_index, buffer, length);
-		error = SendFeedback(port,command,status);
+		int status = UploadCodeinEEPROM(port, eeprom_index, length);
+		error = SendStatus(port,command,status,data);
+		if(error) return error;
+	}
+	
+	// UPDATE CODE IN EEPROM (only the pages that changed, see DeltaUpdateinEEPROM)
+	else if(command==249){
+		uint16_t length = data & 0xffff;
+		uint32_t eeprom_index = data >> 16;
+		int error = SendFeedback(port,command,0);
+		if(error) return error;
+		
+		int status = DeltaUpdateinEEPROM(port, eeprom_index, length);
+		error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
@@ -480,7 +587,7 @@ int ParseCommand(int port)
 	else if(command==246){
 		int length;
 		int status = GetSizeofCode(data, &length);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
@@ -488,10 +595,86 @@ int ParseCommand(int port)
 	else if(command==247){
 		uint8_t byte;
 		int status = ReadCodeinEEPROM(data>>16, data & 0xffff, &byte);
-		int error = SendFeedback(port,command,status);
+		int error = SendStatus(port,command,status,data);
 		if(error) return error;
 	}
 	
+	// READ CHUNK OF CODE IN EEPROM
+	else if(command==248){
+		// data = EEPROM index (8 bits) | number of bytes (8 bits) | address in the code (16 bits)
+		uint16_t address = data & 0xffff;
+		uint16_t length = (data >> 16) & 0xff;
+		uint32_t eeprom_index = (data >> 24) & 0xff;
+		
+		uint8_t buffer[EXT_EEPROM_READ_MAX + 2];
+		int status = (length > EXT_EEPROM_READ_MAX) ? EXT_EEPROM_OVERFLOW : ReadinEEPROM(eeprom_index, address + 2, buffer, length); // Skip length bytes
+		if(status){
+			int error = SendStatus(port,command,status,data);
+			if(error) return error;
+		}
+		else{
+			// Feedback with the number of bytes, then the bytes and their CRC-16 (MSB first)
+			uint16_t crc = Crc16(0xFFFF, buffer, length);
+			buffer[length] = crc >> 8;
+			buffer[length + 1] = crc;
+			int error = SendFeedback(port,command,length);
+			if(error) return error;
+			error = SendBytes(port, buffer, length + 2);
+			if(error) return error;
+		}
+	}
+	
+	// BATCH OF COMMANDS (COBS framing only)
+	else if(command==250){
+		// Message = 250 | flags (bit 0: stop at the first error) | sequence number | N x (command + data)
+		// The commands are executed in order. Reply = feedback (250, number of executed commands) followed by the feedback of each executed command
+		// With a sequence number, a retry of the same batch gets the same reply without executing the commands again (see ReplayBatchResponse)
+		// Commands streaming data (232, 233, 234, 242, 245, 248, 249) and nested batches are refused with COMMUNICATION_BATCH
+		int size = MessageCommandN + MessageDataN;
+		int n = (MessageLength - size - MessageSeqN) / size;
+		if(!IsFramed(port) || n < 1 || MessageLength != size + MessageSeqN + n*size){
+			int error = SendStatus(port,command,COMMUNICATION_FRAME_LENGTH,data);
+			if(error) return error;
+		}
+		else{
+			uint8_t header[MessageCommandN + MessageDataN + MessageSeqN];
+			uint8_t batch[BatchMaxN*(MessageCommandN + MessageDataN)];
+			uint8_t reply[BatchMaxN*(MessageCommandN + MessageDataN)];
+			for(II = 0; II < size + MessageSeqN; II++) header[II] = Message[II];
+			for(II = 0; II < n*size; II++) batch[II] = Message[size + MessageSeqN + II];
+			uint16_t seq = MessageSeq;
+			
+			// Execute each command as a single message, keeping its feedback
+			int executed = 0;
+			MessageLength = size;
+			MessageSeq = 0;
+			for(int JJ = 0; JJ < n; JJ++){
+				for(II = 0; II < size; II++) Message[II] = batch[JJ*size + II];
+				BatchReply = reply + JJ*size;
+				CommandStatus = OK;
+				
+				unsigned int sub = Message[0];
+				if(sub == 232 || sub == 233 || sub == 234 || sub == 242 || sub == 245 || sub == 248 || sub == 249 || sub == 250) SendStatus(port,sub,COMMUNICATION_BATCH,0);
+				else ParseCommand(port);
+				
+				BatchReply = NULL;
+				executed++;
+				if((data & 1) && CommandStatus) break;
+			}
+			
+			// Restore the batch message (for the sequence number of the reply)
+			for(II = 0; II < size + MessageSeqN; II++) Message[II] = header[II];
+			MessageLength = size + MessageSeqN + n*size;
+			MessageSeq = seq;
+			CacheBatchResponse(port, executed, reply);
+			
+			int error = SendFeedback(port,command,executed);
+			if(error) return error;
+			error = SendBytes(port, reply, executed*size);
+			if(error) return error;
+		}
+	}
+	
 	//PING
 	else if(command==255){
 		int error = SendFeedback(port,command,data);
@@ -500,6 +683,8 @@ int ParseCommand(int port)
 	
 	// WRONG COMMAND
 	else{
+		CommandStatus = COMMUNICATION_WRONG_COMMAND;
+		SaveError(COMMUNICATION_WRONG_COMMAND,command,data);
 		int error = SendFeedback(port,254,command);
 		if(error) return error;	
 	}
@@ -507,22 +692,28 @@ int ParseCommand(int port)
 	return OK;
 }
 
-ISR(WDT_vect){
-	// Interrupt before power-up from watchdog
-	// Saves the register
-	SaveRegister(0);
+ISR(WDT_vect, ISR_NOBLOCK){
+	// Interrupt before power-up from watchdog (the next timeout resets the system)
+	// Save now, unless the main loop is in a save: only request it then (see WATCHDOG SAVE in Memory.h)
+	// The other interrupts run during the save (a compaction takes seconds): the bytes received are not lost
+	if(SaveInProgress) WatchdogSave = true;
+	else SaveBeforeReset();
 }
 
-int main(void)
-{	
+void SYSTEM_INIT(void)
+{
 	LoadRegister(0);
+	ERROR_INIT();
 
 	USART0_INIT(9600);
 	USART1_INIT(9600);
     	SPI_INIT(4000000);
 	I2C_INIT(200000);
+	TIMER_INIT();
+	PROFILER_INIT();
 	
 	COMMUNICATION_INIT(1000);
+	XBEE_INIT(REGISTER[memory_XBEE_API] == 1, 9600);
 	POWER_INIT();
     	PICOMOTORS_INIT();
 	//MULTIPLEXER_INIT(0);
@@ -532,30 +723,59 @@ int main(void)
 	
 	//PICOMOTOR_ESTIMATION_INIT(100);
 	//ELECTRODE_ACTUATION_INIT();
-	
-	int ch = 0;
+}
+
+void SystemUpdate(void)
+{
+	// One pass of the main loop (also run by the simulator, see sim/)
 	int status;
 	int port;
 	
+	// Save requested by the watchdog during a save (only the dirty entries, see Memory.h)
+	CheckWatchdogSave();
+	
+	// Receive telecommand (if any)	
+	if((port=IsCommandWaiting())){
+			status = SaveCommand(port);
+			if(status == 0){
+				if(!ReplayResponse(port)){
+					ParseCommand(port);
+					CacheResponse(port);
+				}
+				RecordLatency();
+			}
+			else SaveError(status,0,port);
+	}
+	
+	// Ramp the HV (if any)
+	status = HVRampUpdate();
+	if(status) SaveError(status,213,HVRampCode);
+	
+	// Write the errors to the EEPROM (if any)
+	ErrorFileUpdate();
+	
+	/*
+	// Actuate the electrode
+	static int ch = 0;
+	if(REGISTER[memory_ELECTRODE1 + ch]){
+		status = ActuateElectode(ch);
+		if(status) SetRegister(memory_ELECTRODE1 + ch, 0); // If problem with electrode, turn it off
+	}
+	
+	// Update electrode index
+	if (++ch >= N_electrodes){
+		ch = 0;	
+	}
+		
+		*/	
+}
+
+int main(void)
+{	
+	SYSTEM_INIT();
+	
     while (1)
     {	
-		// Receive telecommand (if any)	
-		if((port=IsCommandWaiting())){
-				status = SaveCommand(port);
-				if(status == 0) ParseCommand(port);
-		}
-		/*
-		// Actuate the electrode
-		if(REGISTER[memory_ELECTRODE1 + ch]){
-			status = ActuateElectode(ch);
-			if(status) REGISTER[memory_ELECTRODE1 + ch] = 0; // If problem with electrode, turn it off
-		}
-		
-		// Update electrode index
-		if (++ch >= N_electrodes){
-			ch = 0;	
-		}
-			
-			*/	
+		SystemUpdate();
     }
 }
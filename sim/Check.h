@@ -0,0 +1,25 @@
+/*
+ * Check.h
+ *
+ * Checks of the sim tests (RegisterTest.c, XBeeTest.c): each check prints "name value", and a FAILED line when the
+ * value is not the expected one. The test ends with Failures checks failed.
+ */
+
+
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <stdio.h>
+
+int Failures = 0;
+
+void Check(const char * name, long value, long expected)
+{
+	printf("%s %ld\n", name, value);
+	if(value != expected){
+		printf("FAILED %s: expected %ld\n", name, expected);
+		Failures++;
+	}
+}
+
+#endif /* CHECK_H_ */
@@ -0,0 +1,164 @@
+/*
+ * Clock.h
+ *
+ * Virtual time of the simulator, as a discrete-event clock.
+ * The models schedule events (a function and its context) at a virtual time. The time only moves from one
+ * event to the next: nothing is computed in between, so an idle hour is a single jump.
+ * Two events at the same time run in the order they were scheduled, and the random numbers come from a
+ * seeded generator: a run is reproduced exactly by the same inputs and the same seed.
+ */
+
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+/*--------------------------------------------------
+                     PARAMETERS
+--------------------------------------------------*/
+#define SIM_EVENT_MAX 256 // Events waiting in the queue (at most)
+#define SIM_NEVER UINT64_MAX
+
+/*--------------------------------------------------
+                       TIME
+--------------------------------------------------*/
+uint64_t SimTime = 0; // Virtual time [ns]
+
+uint64_t SimNow(void)
+{
+	return SimTime;
+}
+uint64_t SimCycles(uint64_t cycles)
+{
+	// Duration of a number of CPU cycles [ns]
+	return cycles*1000000000ULL/F_CPU;
+}
+
+/*--------------------------------------------------
+                      EVENTS
+--------------------------------------------------*/
+typedef void (*sim_handler)(void * context);
+
+struct sim_event{
+	uint64_t time;
+	uint64_t id; // Order of scheduling (breaks the ties)
+	sim_handler handler;
+	void * context;
+};
+
+// Binary heap ordered by (time, id)
+struct sim_event SimEvents[SIM_EVENT_MAX];
+int SimEventCount = 0;
+uint64_t SimEventId = 0;
+uint64_t SimEventsRun = 0; // Number of events run (statistics)
+
+bool SimEventBefore(const struct sim_event * a, const struct sim_event * b)
+{
+	return (a->time < b->time) || (a->time == b->time && a->id < b->id);
+}
+void SimEventSwap(int a, int b)
+{
+	struct sim_event temp = SimEvents[a];
+	SimEvents[a] = SimEvents[b];
+	SimEvents[b] = temp;
+}
+void SimEventUp(int II)
+{
+	while(II > 0 && SimEventBefore(&SimEvents[II], &SimEvents[(II - 1)/2])){
+		SimEventSwap(II, (II - 1)/2);
+		II = (II - 1)/2;
+	}
+}
+void SimEventDown(int II)
+{
+	while(1){
+		int first = II;
+		if(2*II + 1 < SimEventCount && SimEventBefore(&SimEvents[2*II + 1], &SimEvents[first])) first = 2*II + 1;
+		if(2*II + 2 < SimEventCount && SimEventBefore(&SimEvents[2*II + 2], &SimEvents[first])) first = 2*II + 2;
+		if(first == II) return;
+		SimEventSwap(II, first);
+		II = first;
+	}
+}
+uint64_t SimSchedule(uint64_t time, sim_handler handler, void * context)
+{
+	// Run handler(context) at a virtual time (now if in the past). Returns the id of the event (0 if the queue is full)
+	if(SimEventCount == SIM_EVENT_MAX) return 0;
+	if(time < SimTime) time = SimTime;
+
+	struct sim_event * event = &SimEvents[SimEventCount];
+	event->time = time;
+	event->id = ++SimEventId;
+	event->handler = handler;
+	event->context = context;
+	SimEventUp(SimEventCount++);
+	return event->id;
+}
+bool SimCancel(uint64_t id)
+{
+	// Remove an event not run yet
+	for(int II = 0; II < SimEventCount; II++){
+		if(SimEvents[II].id != id) continue;
+		SimEvents[II] = SimEvents[--SimEventCount];
+		if(II < SimEventCount){
+			SimEventUp(II);
+			SimEventDown(II);
+		}
+		return true;
+	}
+	return false;
+}
+uint64_t SimNextEvent(void)
+{
+	// Time of the next event (SIM_NEVER if none)
+	return SimEventCount ? SimEvents[0].time : SIM_NEVER;
+}
+bool SimRunEvent(uint64_t limit)
+{
+	// Move the time to the next event and run it, if it happens at limit at the latest
+	if(!SimEventCount || SimEvents[0].time > limit) return false;
+
+	struct sim_event event = SimEvents[0];
+	SimEvents[0] = SimEvents[--SimEventCount];
+	SimEventDown(0);
+
+	if(event.time > SimTime) SimTime = event.time;
+	SimEventsRun++;
+	event.handler(event.context);
+	return true;
+}
+
+/*--------------------------------------------------
+                  RANDOM NUMBERS
+--------------------------------------------------*/
+// xorshift64* generator: the same seed gives the same sequence on every host
+uint64_t SimRandomState = 0x9E3779B97F4A7C15ULL;
+
+void SimSeed(uint64_t seed)
+{
+	SimRandomState = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+uint32_t SimRandom(void)
+{
+	SimRandomState ^= SimRandomState >> 12;
+	SimRandomState ^= SimRandomState << 25;
+	SimRandomState ^= SimRandomState >> 27;
+	return (SimRandomState*0x2545F4914F6CDD1DULL) >> 32;
+}
+double SimUniform(void)
+{
+	// In ]0, 1[
+	return (SimRandom() + 0.5)/4294967296.0;
+}
+double SimGaussian(double mean, double std)
+{
+	// Box-Muller (one draw after the other: the order of evaluation of the arguments is not fixed in C)
+	double u1 = SimUniform();
+	double u2 = SimUniform();
+	return mean + std*sqrt(-2*log(u1))*cos(2*M_PI*u2);
+}
+
+#endif /* CLOCK_H_ */
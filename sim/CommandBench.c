@@ -0,0 +1,306 @@
+/*
+ * CommandBench.c
+ *
+ * End-to-end command benchmark on the simulator: a host on USART0 replays a mix of commands, each sent once
+ * the reply of the previous one has arrived, and measures them on the wire.
+ * For each mix and baud rate, prints one CSV line (header first):
+ * commands per second, latency percentiles (first byte sent to last byte of the reply) and bytes on the wire
+ * per command in each direction. Each configuration runs in its own process, from power on.
+ *
+ * Mixes:
+ * - ping: PING (255)
+ * - register: register write (HV_TOL_V) and read (150)
+ * - move: picomotor 0 by +/-10 ticks (181) and encoder state (186)
+ * - electrode: actuation of the 41 electrodes in turn (214), HV ramped to the bias
+ * - upload: code upload to the EEPROM (245) in chunks of EXT_EEPROM_PAGE_SIZE, each one acknowledged
+ * - mixed: 40% ping, 30% register, 10% move, 10% electrode, 10% upload
+ * - batch: batch (250) with a sequence number of a register write, a read of the message count and a PING,
+ *   sent again as the retry of a lost reply (COBS framing). The retry must get the same reply without executing
+ *   the commands again (replay cache), otherwise the command is failed
+ *
+ * Bauds (default): 9600 to 76800, and the double speed (U2X) rates 250000, 500000 and 1000000.
+ * 57600 is expected to be refused by USART0_INIT (UART0_BAUD_ERROR: 2.1% error at 8 MHz).
+ * The status column is the result of the configuration (0, or the error of the init): a refused rate has a full
+ * row with empty metrics.
+ * Each configuration is checked against the result expected for its rate (ExpectedStatus): the init status, and
+ * no failed command when the rate is accepted. A mismatch is reported on stderr and the exit status is 1.
+ *
+ * Usage: command_bench [commands] [seed] [mixes] [bauds] [upload_bytes]
+ *        (mixes and bauds separated by commas, e.g. command_bench 200 1 ping,mixed 9600,38400)
+ */
+
+
+#include "Simulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define BENCH_COMMANDS_MAX 10000
+#define BENCH_STEPS_MAX (EXT_EEPROM_MAX_ADDR/EXT_EEPROM_PAGE_SIZE + 2)
+#define BENCH_TIMEOUT_NS 10000000000ULL // A command without complete reply after 10 s is failed
+
+enum bench_kind {BENCH_PING, BENCH_REGISTER, BENCH_MOVE, BENCH_ELECTRODE, BENCH_UPLOAD, BENCH_BATCH};
+
+// Command being exchanged: bytes sent at each step, each step answered by one feedback
+struct bench_step{
+	uint8_t bytes[EXT_EEPROM_PAGE_SIZE + 2];
+	int len;
+};
+struct bench_step Steps[BENCH_STEPS_MAX];
+int StepCount, Step;
+uint8_t Reply[MessageN];
+int ReplyLen;
+bool Framed; // Batch mix: COBS framing on USART0, replies of two frames
+uint8_t FrameReply[2][2*sizeof(FrameBuffer)]; // Reply of the batch and of its retry, as received
+int FrameReplyLen[2], Delimiters;
+bool Failed; // A feedback carried an error status
+
+// Statistics
+int Commands; // Commands to run
+int Done, FailedCount;
+double Latency[BENCH_COMMANDS_MAX]; // [ms]
+uint64_t Start, CommandStart, TimeoutEvent;
+uint64_t BytesOut, BytesIn; // To the board, from the board
+const char * Mix;
+int UploadBytes;
+int Counter; // Alternates the commands of a mix
+
+void NextCommand(void);
+
+void AddStep(const uint8_t * bytes, int len)
+{
+	memcpy(Steps[StepCount].bytes, bytes, len);
+	Steps[StepCount].len = len;
+	StepCount++;
+}
+void AddMessage(uint8_t command, int32_t data)
+{
+	// Legacy message: command + data (MSB first)
+	uint8_t message[MessageN] = {command, data >> 24, data >> 16, data >> 8, data};
+	AddStep(message, MessageN);
+}
+void PutMessage(uint8_t * out, uint8_t command, int32_t data)
+{
+	out[0] = command;
+	for(int II = 0; II < MessageDataN; II++) out[MessageCommandN + II] = data >> 8*(MessageDataN - II - 1);
+}
+void AddBatch(uint16_t seq)
+{
+	// Batch frame (payload + CRC-16, COBS encoded), then the same frame again (retry)
+	uint8_t payload[FrameMaxN + 2], frame[sizeof(FrameBuffer) + 1];
+	int size = MessageCommandN + MessageDataN;
+	int len = size + MessageSeqN;
+	PutMessage(payload, 250, 0);
+	payload[size] = seq >> 8;
+	payload[size + 1] = seq;
+	PutMessage(payload + len, memory_HV_TOL_V, seq);
+	PutMessage(payload + len + size, 150, memory_MESSAGE_COUNT0);
+	PutMessage(payload + len + 2*size, 255, seq);
+	len += 3*size;
+	uint16_t crc = Crc16(0xFFFF, payload, len);
+	payload[len++] = crc >> 8;
+	payload[len++] = crc;
+	int n = CobsEncode(payload, len, frame);
+	frame[n++] = FrameDelimiter;
+	AddStep(frame, n);
+	AddStep(frame, n);
+}
+void AddUpload(int len)
+{
+	// Command, then the chunks with their CRC-16 (random code)
+	AddMessage(245, len & 0xffff);
+	for(int sent = 0; sent < len; sent += EXT_EEPROM_PAGE_SIZE){
+		uint8_t chunk[EXT_EEPROM_PAGE_SIZE + 2];
+		int n = (len - sent < EXT_EEPROM_PAGE_SIZE) ? len - sent : EXT_EEPROM_PAGE_SIZE;
+		for(int II = 0; II < n; II++) chunk[II] = SimRandom();
+		uint16_t crc = Crc16(0xFFFF, chunk, n);
+		chunk[n] = crc >> 8;
+		chunk[n + 1] = crc;
+		AddStep(chunk, n + 2);
+	}
+}
+int PickKind(void)
+{
+	if(!strcmp(Mix, "ping")) return BENCH_PING;
+	if(!strcmp(Mix, "register")) return BENCH_REGISTER;
+	if(!strcmp(Mix, "move")) return BENCH_MOVE;
+	if(!strcmp(Mix, "electrode")) return BENCH_ELECTRODE;
+	if(!strcmp(Mix, "upload")) return BENCH_UPLOAD;
+	if(!strcmp(Mix, "batch")) return BENCH_BATCH;
+
+	double draw = SimUniform();
+	if(draw < 0.4) return BENCH_PING;
+	if(draw < 0.7) return BENCH_REGISTER;
+	if(draw < 0.8) return BENCH_MOVE;
+	if(draw < 0.9) return BENCH_ELECTRODE;
+	return BENCH_UPLOAD;
+}
+void SendStep(void)
+{
+	BytesOut += Steps[Step].len;
+	ReplyLen = 0;
+	FrameReplyLen[Step % 2] = 0;
+	Delimiters = 0;
+	SimUsartSend(0, Steps[Step].bytes, Steps[Step].len);
+}
+void CommandEnd(bool timeout)
+{
+	if(!timeout) SimCancel(TimeoutEvent);
+	if(timeout || Failed) FailedCount++;
+	Latency[Done++] = (SimNow() - CommandStart)/1e6;
+	if(Done < Commands) NextCommand();
+}
+void CommandTimeout(void * context)
+{
+	// Drop what was received and go on with the next command
+	uint8_t flush[64];
+	while(SimUsartReceive(0, flush, sizeof(flush)));
+	CommandEnd(true);
+}
+void HostReceiveFrames(void)
+{
+	// Batch mix: the reply is the feedback (250, executed) then the feedback of each command, in two frames
+	uint8_t * reply = FrameReply[Step % 2];
+	int * len = &FrameReplyLen[Step % 2];
+	int n = SimUsartReceive(0, reply + *len, sizeof(FrameReply[0]) - *len);
+	BytesIn += n;
+	for(int II = *len; II < *len + n; II++) if(reply[II] == FrameDelimiter) Delimiters++;
+	*len += n;
+	if(Delimiters < 2) return;
+
+	uint8_t feedback[sizeof(FrameReply[0])];
+	memcpy(feedback, reply, *len);
+	int size = CobsDecode(feedback, memchr(feedback, FrameDelimiter, *len) - (void *)feedback);
+	if(size != MessageCommandN + MessageDataN + MessageSeqN + 2 || feedback[0] != 250 || feedback[4] != 3) Failed = true;
+	if(Step == 1){
+		// Retry: same bytes, answered from the replay cache
+		if(FrameReplyLen[0] != FrameReplyLen[1] || memcmp(FrameReply[0], FrameReply[1], FrameReplyLen[0])) Failed = true;
+		if(REGISTER[memory_REPLAYS0] != Done + 1) Failed = true;
+	}
+	if(++Step < StepCount) SendStep();
+	else CommandEnd(false);
+}
+void HostReceive(int port)
+{
+	// A byte of the reply arrived: next step once the feedback is complete
+	if(port != 0 || Done >= Commands) return;
+	if(Framed){
+		HostReceiveFrames();
+		return;
+	}
+	int len = SimUsartReceive(0, Reply + ReplyLen, MessageN - ReplyLen);
+	BytesIn += len;
+	ReplyLen += len;
+	if(ReplyLen < MessageN) return;
+
+	int32_t status = ((int32_t)Reply[1] << 24) | ((int32_t)Reply[2] << 16) | ((int32_t)Reply[3] << 8) | Reply[4];
+	if(Reply[0] == 254 || (Reply[0] != 150 && Reply[0] != 255 && Reply[0] >= 151 && status)) Failed = true;
+	if(++Step < StepCount) SendStep();
+	else CommandEnd(false);
+}
+void NextCommand(void)
+{
+	StepCount = 0;
+	switch(PickKind()){
+		case BENCH_PING: AddMessage(255, Counter); break;
+		case BENCH_REGISTER:
+			if(Counter % 2) AddMessage(150, memory_HV_TOL_V);
+			else AddMessage(memory_HV_TOL_V, 31);
+			break;
+		case BENCH_MOVE:
+			if(Counter % 2) AddMessage(186, 0);
+			else AddMessage(181, (Counter % 4) ? -10 : 10);
+			break;
+		case BENCH_ELECTRODE: AddMessage(214, Counter % N_electrodes); break;
+		case BENCH_UPLOAD: AddUpload(UploadBytes); break;
+		case BENCH_BATCH: AddBatch(Counter + 1); break;
+	}
+	Counter++;
+
+	Step = 0;
+	Failed = false;
+	CommandStart = SimNow();
+	TimeoutEvent = SimSchedule(SimNow() + BENCH_TIMEOUT_NS, CommandTimeout, NULL);
+	SendStep();
+}
+
+int ExpectedStatus(unsigned long baud)
+{
+	// Status of USART0_INIT expected for the rate at 8 MHz (Interfaces.h)
+	if(baud == 57600 || baud == 115200 || baud == 230400) return UART0_BAUD_ERROR;
+	return OK;
+}
+int CompareDouble(const void * a, const void * b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+int Run(const char * mix, unsigned long baud, uint64_t seed)
+{
+	// One configuration, from power on
+	Mix = mix;
+	SimSeed(seed);
+	SimInit();
+	int status = USART0_INIT(baud);
+	if(status) return status;
+
+	// Board ready for the moves and the electrodes
+	status = ADC_INIT(125000); // HV feedback of the ramp
+	if(!status) status = PICOMOTOR_ESTIMATION_INIT(100);
+	if(!status) status = MULTIPLEXER_INIT(0);
+	if(!status) status = MULTIPLEXER_INIT(1);
+	if(!status) status = ELECTRODE_ACTUATION_INIT();
+	if(status) return status;
+	while(IsHVRampRunning()) SimRun(1000000);
+	Framed = !strcmp(mix, "batch");
+	if(Framed) SetRegister(memory_FRAMING0, FRAMING_COBS);
+
+	SimUsartHost = HostReceive;
+	Start = SimNow();
+	NextCommand();
+	while(Done < Commands) SimRun(1000000);
+	double seconds = (SimNow() - Start)/1e9;
+
+	qsort(Latency, Done, sizeof(double), CompareDouble);
+	printf("%s,%lu,%d,%d,%d,%.3f,%.2f,%.3f,%.3f,%.3f,%.3f,%.2f,%.2f\n", mix, baud, OK, Done, FailedCount,
+		seconds, Done/seconds,
+		Latency[Done/2], Latency[(int)(0.9*(Done - 1))], Latency[(int)(0.99*(Done - 1))], Latency[Done - 1],
+		(double)BytesOut/Done, (double)BytesIn/Done);
+	return OK;
+}
+
+int main(int argc, char ** argv)
+{
+	Commands = (argc > 1) ? atoi(argv[1]) : 200;
+	uint64_t seed = (argc > 2) ? strtoull(argv[2], NULL, 0) : 1;
+	char mixes[256], bauds[256];
+	snprintf(mixes, sizeof(mixes), "%s", (argc > 3) ? argv[3] : "ping,register,move,electrode,upload,mixed,batch");
+	snprintf(bauds, sizeof(bauds), "%s", (argc > 4) ? argv[4] : "9600,19200,38400,57600,76800,250000,500000,1000000");
+	UploadBytes = (argc > 5) ? atoi(argv[5]) : 256;
+	if(Commands < 1 || Commands > BENCH_COMMANDS_MAX || UploadBytes < 1 || UploadBytes > EXT_EEPROM_MAX_ADDR - 1) return 1;
+
+	printf("mix,baud,status,commands,failed,virtual_s,commands_per_s,latency_p50_ms,latency_p90_ms,latency_p99_ms,latency_max_ms,bytes_to_board,bytes_from_board\n");
+	fflush(NULL); // stdout is the stream of the firmware here (SimHal.h)
+	int mismatches = 0;
+	for(char * mix = strtok(mixes, ","); mix; mix = strtok(NULL, ",")){
+		char list[256];
+		memcpy(list, bauds, sizeof(list));
+		for(char * save, * baud = strtok_r(list, ",", &save); baud; baud = strtok_r(NULL, ",", &save)){
+			int expected = ExpectedStatus(strtoul(baud, NULL, 10));
+			pid_t pid = fork();
+			if(pid == 0){
+				int status = Run(mix, strtoul(baud, NULL, 10), seed);
+				if(status) printf("%s,%s,%d,,,,,,,,,,\n", mix, baud, status); // No metrics
+				fflush(NULL); // stdout is the stream of the firmware here (SimHal.h)
+				if(status != expected) fprintf(stderr, "command_bench: %s at %s: status %d, expected %d\n", mix, baud, status, expected);
+				else if(FailedCount) fprintf(stderr, "command_bench: %s at %s: %d failed commands\n", mix, baud, FailedCount);
+				_exit(status != expected || FailedCount);
+			}
+			int result;
+			waitpid(pid, &result, 0);
+			if(!WIFEXITED(result) || WEXITSTATUS(result)) mismatches++;
+		}
+	}
+	return mismatches ? 1 : 0;
+}
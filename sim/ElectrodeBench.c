@@ -0,0 +1,153 @@
+/*
+ * ElectrodeBench.c
+ *
+ * Electrode sweep benchmark on the simulator: a random shape is written to the electrode registers and
+ * actuated with ActuateElectode in the order of a strategy, against the plant model of Electrodes.h.
+ * Reports the duration of the sweep and the charge error of the shape at its end and after a hold time
+ * (one "name value" per line). With a trace period, the charge error of every electrode over time is
+ * printed as CSV lines "trace,time_ms,error_0,...,error_40" [pC].
+ *
+ * The HV ramp to the bias is run first: with a slow supply (hv_settle_ms, time constant of the HV outputs) it waits
+ * for the feedback to reach each step (ramp_ms, ramp_samples). Without a timeout the ramp must end within one step
+ * of the bias (ramp_error_v), otherwise the exit status is 1.
+ *
+ * Strategies: index (channel 0 to 40), sorted (order of SortVoltages), ascending (increasing voltage).
+ * Usage: electrode_bench [strategy] [hv_timer_ms] [charge_ms] [seed] [hold_ms] [trace_ms] [hv_settle_ms]
+ */
+
+
+#include "Simulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+uint64_t TraceNext = SIM_NEVER; // Time of the next line of the trace
+uint64_t TracePeriod = 0;
+
+void TraceEvent(void * context)
+{
+	// Charge error of all the electrodes
+	printf("trace,%.3f", SimNow()/1e6);
+	for(int ch = 0; ch < SIM_ELECTRODE_COUNT; ch++) printf(",%.3f", SimElectrodeError(ch));
+	printf("\n");
+	SimSchedule(SimNow() + TracePeriod, TraceEvent, NULL);
+}
+void ShapeError(const char * name)
+{
+	// RMS and largest charge error of the shape
+	double sum = 0, max = 0;
+	for(int ch = 0; ch < SIM_ELECTRODE_COUNT; ch++){
+		double error = SimElectrodeError(ch);
+		sum += error*error;
+		if(fabs(error) > max) max = fabs(error);
+	}
+	printf("%s_rms_pc %.3f\n", name, sqrt(sum/SIM_ELECTRODE_COUNT));
+	printf("%s_max_pc %.3f\n", name, max);
+}
+
+int main(int argc, char ** argv)
+{
+	const char * strategy = (argc > 1) ? argv[1] : "sorted";
+	int hv_timer = (argc > 2) ? atoi(argv[2]) : 1000;
+	int charge = (argc > 3) ? atoi(argv[3]) : 10;
+	uint64_t seed = (argc > 4) ? strtoull(argv[4], NULL, 0) : 1;
+	double hold = (argc > 5) ? atof(argv[5]) : 10000;
+	double trace = (argc > 6) ? atof(argv[6]) : 0;
+	double hv_settle = (argc > 7) ? atof(argv[7]) : SIM_HV_SETTLE_NS/1e6;
+	if(charge < 0 || charge > 255 || hv_timer < 0 || hv_settle <= 0) return 1;
+
+	SimSeed(seed);
+	SimInit();
+	SimHvSettleNs = hv_settle*1e6;
+
+	// ADC on (command 155, HV feedback), multiplexers on (command 210), HV on and ramped to the bias
+	int status = ADC_INIT(125000);
+	if(!status) status = MULTIPLEXER_INIT(0);
+	if(!status) status = MULTIPLEXER_INIT(1);
+	if(!status) status = ELECTRODE_ACTUATION_INIT();
+	if(status){
+		printf("init_error %d\n", status);
+		return 1;
+	}
+	uint64_t start = SimNow();
+	int samples = 0;
+	while(IsHVRampRunning()){
+		uint32_t sample = HVRampSampleTick;
+		SimRun(1000000);
+		if(HVRampSampleTick != sample) samples++;
+	}
+	if(HVRampState != HV_RAMP_DONE){
+		printf("ramp_error %d\n", HVRampState);
+		return 1;
+	}
+	printf("hv_settle_ms %.3f\n", hv_settle);
+	printf("ramp_ms %.3f\n", (SimNow() - start)/1e6);
+	printf("ramp_samples %d\n", samples);
+	printf("ramp_timeouts %ld\n", (long)REGISTER[memory_HV_RAMP_TIMEOUTS]);
+	double ramp_error = SimHv[0].volts - SimHvVolts(REGISTER[memory_HV_BIAS]);
+	printf("ramp_error_v %.3f\n", ramp_error);
+	if(!REGISTER[memory_HV_RAMP_TIMEOUTS] && fabs(ramp_error) >= REGISTER[memory_HV_STEP]*SIM_HV_VOLTS_PER_CODE){
+		printf("ramp_error_v above one step\n");
+		return 1;
+	}
+	SetRegister(memory_HV_TIMER, hv_timer);
+
+	// Random shape within the limit around the bias
+	int32_t bias = REGISTER[memory_HV_BIAS], limit = REGISTER[memory_ELECTRODE_LIMIT_V];
+	unsigned int voltages[SIM_ELECTRODE_COUNT], sorted[SIM_ELECTRODE_COUNT], order[SIM_ELECTRODE_COUNT];
+	for(int ch = 0; ch < SIM_ELECTRODE_COUNT; ch++){
+		voltages[ch] = bias + (int32_t)((2*SimUniform() - 1)*limit);
+		SetRegister(memory_ELECTRODE1 + ch, ((int32_t)charge << 24) | ((int32_t)charge << 16) | voltages[ch]);
+	}
+
+	// Order of the sweep
+	if(!strcmp(strategy, "index")){
+		for(int ch = 0; ch < SIM_ELECTRODE_COUNT; ch++) order[ch] = ch;
+	}
+	else if(!strcmp(strategy, "sorted") || !strcmp(strategy, "ascending")){
+		unsigned int copy[SIM_ELECTRODE_COUNT];
+		memcpy(copy, voltages, sizeof(copy));
+		SortVoltages(copy, sorted, order, SIM_ELECTRODE_COUNT);
+
+		// SortVoltages sorts copy in ascending order, its channels go down the first half of the triangle and up the second
+		if(!strcmp(strategy, "ascending")){
+			unsigned int triangle[SIM_ELECTRODE_COUNT];
+			memcpy(triangle, order, sizeof(triangle));
+			for(int II = 0; II < SIM_ELECTRODE_COUNT; II++){
+				order[II] = (II % 2) ? triangle[SIM_ELECTRODE_COUNT - (II + 1)/2] : triangle[II/2];
+			}
+		}
+	}
+	else{
+		printf("unknown_strategy %s\n", strategy);
+		return 1;
+	}
+
+	// Sweep
+	if(trace > 0){
+		TracePeriod = (uint64_t)(trace*1e6);
+		SimSchedule(SimNow(), TraceEvent, NULL);
+	}
+	start = SimNow();
+	int failed = 0, settles = 0;
+	for(int II = 0; II < SIM_ELECTRODE_COUNT; II++){
+		if(voltages[order[II]] != (unsigned int)REGISTER[memory_HV]) settles++; // HV changed: HV_TIMER wait
+		status = ActuateElectode(order[II]);
+		if(status) failed++;
+	}
+	double sweep = (SimNow() - start)/1e6;
+
+	printf("strategy %s\n", strategy);
+	printf("hv_timer_ms %d\n", hv_timer);
+	printf("charge_ms %d\n", charge);
+	printf("seed %llu\n", (unsigned long long)seed);
+	printf("failed %d\n", failed);
+	printf("hv_changes %d\n", settles);
+	printf("sweep_ms %.3f\n", sweep);
+	ShapeError("end");
+
+	// Hold: the electrodes leak
+	SimRun((uint64_t)(hold*1e6));
+	printf("hold_ms %.3f\n", hold);
+	ShapeError("hold");
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Electrodes.h
+ *
+ * Plant model of the HV supply and of the electrodes, included by Simulator.h.
+ * The HV and bias outputs follow their DAC code (SimDac) with a first-order settling: 0x3FFF is 0V and each
+ * code below adds SIM_HV_VOLTS_PER_CODE (HV_BIAS 8191 = +240V). An output is only driven with 5V, 12V and
+ * its current limiter enabled (CL3 for the HV, CL2 for the bias), else it decays to 0V.
+ * The outputs are fed back on the ADC channels HV_VOLTAGE and HV_GROUND (2.5V at 0V, SIM_HV_FEEDBACK_GAIN
+ * per volt): the values set with SimSetAdc on these channels are overwritten.
+ *
+ * Each of the 41 electrodes is a capacitance charged from the HV output through its MAX6956 switch (MPIC and
+ * MPport in Drivers.h), and discharged by its leakage. The charge error of an electrode is the difference
+ * with the charge at the voltage of its register (memory_ELECTRODEn): SimElectrodeError.
+ * The state is computed when an input changes (DAC latched, switch written) or is read, so idle time costs nothing.
+ */
+
+
+#ifndef ELECTRODES_H_
+#define ELECTRODES_H_
+
+/*--------------------------------------------------
+                     PARAMETERS
+--------------------------------------------------*/
+#define SIM_ELECTRODE_COUNT N_electrodes
+#define SIM_HV_VOLTS_PER_CODE (240.0/8192) // Output voltage per DAC code below 0x3FFF [V]
+#define SIM_HV_SETTLE_NS 5e6 // Time constant of the HV outputs [ns]
+#define SIM_HV_FEEDBACK_ZERO 2.5 // Feedback at 0V [V] (TWO_FIVE_V)
+#define SIM_HV_FEEDBACK_GAIN 0.005 // Feedback per volt of output [V/V] (decreasing)
+#define SIM_ADC_VREF 3.3 // Reference of the ADC [V]
+#define SIM_ELECTRODE_PF 100.0 // Capacitance of an electrode [pF]
+#define SIM_ELECTRODE_CHARGE_NS 1e6 // Time constant of the charge through a switch [ns]
+#define SIM_ELECTRODE_LEAK_NS 60e9 // Time constant of the leakage [ns]
+
+/*--------------------------------------------------
+                      MODEL
+--------------------------------------------------*/
+struct sim_hv_output{
+	double volts; // Output voltage
+	double target; // Voltage it settles to
+};
+struct sim_hv_output SimHv[2]; // HV (SELECT_HV - 1), bias (SELECT_BIAS - 1)
+
+struct sim_electrode{
+	double volts; // Voltage of the electrode
+	bool closed; // State of its switch
+	uint32_t charges; // Number of times its switch was closed
+	uint64_t closed_ns; // Total time its switch was closed
+};
+struct sim_electrode SimElectrode[SIM_ELECTRODE_COUNT];
+
+// Time constants, can be changed by the host [ns]
+double SimHvSettleNs = SIM_HV_SETTLE_NS;
+double SimElectrodeChargeNs = SIM_ELECTRODE_CHARGE_NS;
+double SimElectrodeLeakNs = SIM_ELECTRODE_LEAK_NS;
+uint64_t SimElectrodeTime = 0; // Time of the state
+
+double SimHvVolts(uint16_t code)
+{
+	return (0x3FFF - (int)(code & 0x3FFF))*SIM_HV_VOLTS_PER_CODE;
+}
+bool SimHvPowered(int output)
+{
+	// 5V, 12V and the current limiter of the output (active low)
+	uint8_t cl = output ? CL2_E : CL3_E;
+	return (PORT_SV & (1<<FIVE_V_E)) && (PORT_SV & (1<<TWELVE_V_E)) && !(PORT_CL_E & (1<<cl));
+}
+bool SimElectrodeClosed(int ch)
+{
+	// Switch of the electrode: port on and multiplexer in normal mode
+	int mux = ch/42 + MPIC[ch%42];
+	return (SimMultiplexer[mux].reg[0x04] & 1) && SimMuxPort(mux, MPport[ch%42] - 0x20);
+}
+uint16_t SimHvFeedback(double volts)
+{
+	double v = SIM_HV_FEEDBACK_ZERO - SIM_HV_FEEDBACK_GAIN*volts;
+	if(v < 0) v = 0;
+	if(v > SIM_ADC_VREF) v = SIM_ADC_VREF;
+	return (uint16_t)lround(v/SIM_ADC_VREF*1023);
+}
+void SimElectrodesStep(double ns, const bool * closed)
+{
+	// Outputs settle to their target, electrodes charge toward the average HV of the step or leak
+	double hv = SimHv[0].volts;
+	for(int II = 0; II < 2; II++){
+		SimHv[II].volts = SimHv[II].target + (SimHv[II].volts - SimHv[II].target)*exp(-ns/SimHvSettleNs);
+	}
+	hv = (hv + SimHv[0].volts)/2;
+
+	// Closed: dV/dt = (hv - V)/charge - V/leak
+	double rate = 1/SimElectrodeChargeNs + 1/SimElectrodeLeakNs;
+	double final = hv/SimElectrodeChargeNs/rate;
+	for(int ch = 0; ch < SIM_ELECTRODE_COUNT; ch++){
+		struct sim_electrode * e = &SimElectrode[ch];
+		if(closed[ch]) e->volts = final + (e->volts - final)*exp(-ns*rate);
+		else e->volts *= exp(-ns/SimElectrodeLeakNs);
+	}
+}
+void SimElectrodesUpdate(void)
+{
+	// Bring the state to the current time (inputs unchanged since the last update)
+	uint64_t elapsed = SimTime - SimElectrodeTime;
+	SimElectrodeTime = SimTime;
+
+	bool closed[SIM_ELECTRODE_COUNT];
+	bool any = false;
+	for(int ch = 0; ch < SIM_ELECTRODE_COUNT; ch++){
+		closed[ch] = SimElectrodeClosed(ch);
+		if(closed[ch]){
+			SimElectrode[ch].closed_ns += elapsed;
+			any = true;
+		}
+	}
+	for(int II = 0; II < 2; II++) SimHv[II].target = SimHvPowered(II) ? SimHvVolts(SimDac[II].code) : 0;
+
+	// Exact in one step, unless an electrode charges while the HV moves: steps of a fraction of the time constants
+	double step = fmin(SimHvSettleNs, SimElectrodeChargeNs)/8;
+	double left = elapsed;
+	while(left > 0){
+		double ns = left;
+		if(any && fabs(SimHv[0].volts - SimHv[0].target) > 1e-6 && ns > step) ns = step;
+		SimElectrodesStep(ns, closed);
+		left -= ns;
+	}
+
+	SimAdc[HV_VOLTAGE] = SimHvFeedback(SimHv[0].volts);
+	SimAdc[HV_GROUND] = SimHvFeedback(SimHv[1].volts);
+}
+void SimElectrodeSwitches(void)
+{
+	// Count the switches that close (after a write to a multiplexer)
+	for(int ch = 0; ch < SIM_ELECTRODE_COUNT; ch++){
+		bool closed = SimElectrodeClosed(ch);
+		if(closed && !SimElectrode[ch].closed) SimElectrode[ch].charges++;
+		SimElectrode[ch].closed = closed;
+	}
+}
+void SimElectrodesInit(void)
+{
+	memset(SimHv, 0, sizeof(SimHv));
+	memset(SimElectrode, 0, sizeof(SimElectrode));
+	SimElectrodeTime = SimTime;
+	SimElectrodesUpdate();
+}
+double SimElectrodeTargetVolts(int ch)
+{
+	// Voltage commanded by the register of the electrode
+	return SimHvVolts(REGISTER[memory_ELECTRODE1 + ch] & 0xFFFF);
+}
+double SimElectrodeError(int ch)
+{
+	// Charge error of an electrode now [pC]
+	SimElectrodesUpdate();
+	return SIM_ELECTRODE_PF*(SimElectrode[ch].volts - SimElectrodeTargetVolts(ch));
+}
+
+#endif /* ELECTRODES_H_ */
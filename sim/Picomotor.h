@@ -0,0 +1,154 @@
+/*
+ * Picomotor.h
+ *
+ * Plant model of the three picomotors and their encoders, included by Simulator.h.
+ * The drivers are the pins of the MCP23S17 (IOEport and IOEpin in Drivers.h): a tick is a pulse on the HIGH
+ * switch followed by a pulse on the LOW switch. The slow pulse (HIGH forward, LOW backward) must last
+ * SIM_PICO_SLOW_NS at least, else the tick is missed. The motors only move with 12V on and CL1 enabled.
+ *
+ * Each tick moves the actuator by a random step: mean step_nm forward, step_nm*(1 + asymmetry) backward,
+ * standard deviation step_std_nm. The mirror follows the actuator with a play of backlash_nm when the
+ * direction changes. The quadrature encoder changes state every interval_nm of the mirror position
+ * (state00, state10, state11, state01 forward), on the ENCODERnA/B pins.
+ * Position 0 is an interval limit: the calibrated 0 of SetPicomotorLocation.
+ */
+
+
+#ifndef PICOMOTOR_H_
+#define PICOMOTOR_H_
+
+/*--------------------------------------------------
+                     PARAMETERS
+--------------------------------------------------*/
+#define SIM_PICO_COUNT 3
+#define SIM_PICO_STEP_NM 28.0 // Mean forward step [nm]
+#define SIM_PICO_STEP_STD_NM 4.0 // Standard deviation of a step [nm]
+#define SIM_PICO_ASYMMETRY 0.1 // Backward steps are 10% larger
+#define SIM_PICO_BACKLASH_NM 40.0 // Play between the actuator and the mirror [nm]
+#define SIM_PICO_INTERVAL_NM 212.0 // Encoder interval [nm] (memory_ENCODERn_INTERVAL_SIZE)
+#define SIM_PICO_SLOW_NS 200000 // Shortest slow pulse producing a tick [ns]
+
+/*--------------------------------------------------
+                      MODEL
+--------------------------------------------------*/
+// Switches of a motor, in the order of IOEpin
+enum sim_pico_switch {SIM_FW_HIGH, SIM_FW_LOW, SIM_BW_HIGH, SIM_BW_LOW};
+
+struct sim_picomotor{
+	// Parameters
+	double step_nm;
+	double step_std_nm;
+	double asymmetry;
+	double backlash_nm;
+	double interval_nm;
+
+	// State
+	double actuator_nm; // Position of the actuator
+	double position_nm; // Position of the mirror (seen by the encoder)
+	uint64_t rise[4]; // Time each switch was turned on (0 = off)
+	uint64_t slow[2]; // Length of the last HIGH pulse (forward, backward)
+
+	// Statistics
+	uint32_t ticks[2]; // Ticks done (forward, backward)
+	uint32_t missed; // Pulses that did not produce a tick
+};
+struct sim_picomotor SimPicomotor[SIM_PICO_COUNT];
+uint8_t SimPicomotorPort[2]; // Output levels of the expander ports
+
+// Encoder pins of each motor
+volatile uint8_t * const SimEncoderPin[SIM_PICO_COUNT] = {&PIN_ENCODER0, &PIN_ENCODER1, &PIN_ENCODER2};
+const uint8_t SimEncoderA[SIM_PICO_COUNT] = {ENCODER0A, ENCODER1A, ENCODER2A};
+const uint8_t SimEncoderB[SIM_PICO_COUNT] = {ENCODER0B, ENCODER1B, ENCODER2B};
+
+void SimEncoderUpdate(int index)
+{
+	// Quadrature state of the interval of the mirror
+	struct sim_picomotor * motor = &SimPicomotor[index];
+	long interval = (long)floor(motor->position_nm/motor->interval_nm);
+	int state = ((interval % 4) + 4) % 4; // state00, state10, state11, state01
+	SimSetPin(SimEncoderPin[index], SimEncoderA[index], state == state10 || state == state11);
+	SimSetPin(SimEncoderPin[index], SimEncoderB[index], state == state11 || state == state01);
+}
+void SimPicomotorPlace(int index, double position_nm)
+{
+	// Put a motor at a position, play taken up forward
+	struct sim_picomotor * motor = &SimPicomotor[index];
+	motor->position_nm = position_nm;
+	motor->actuator_nm = position_nm + motor->backlash_nm/2;
+	SimEncoderUpdate(index);
+}
+void SimPicomotorInit(void)
+{
+	for(int II = 0; II < SIM_PICO_COUNT; II++){
+		struct sim_picomotor * motor = &SimPicomotor[II];
+		memset(motor, 0, sizeof(*motor));
+		motor->step_nm = SIM_PICO_STEP_NM;
+		motor->step_std_nm = SIM_PICO_STEP_STD_NM;
+		motor->asymmetry = SIM_PICO_ASYMMETRY;
+		motor->backlash_nm = SIM_PICO_BACKLASH_NM;
+		motor->interval_nm = SIM_PICO_INTERVAL_NM;
+		SimPicomotorPlace(II, motor->interval_nm/2);
+	}
+	SimPicomotorPort[0] = SimPicomotorPort[1] = 0;
+}
+bool SimPicomotorPowered(void)
+{
+	// 12V enabled and current limiter 1 enabled (active low)
+	return (PORT_SV & (1<<TWELVE_V_E)) && !(PORT_CL_E & (1<<CL1_E));
+}
+void SimPicomotorTick(int index, int dir)
+{
+	// One step of the actuator; the mirror moves once the play is taken up
+	struct sim_picomotor * motor = &SimPicomotor[index];
+	double step = SimGaussian(motor->step_nm*(dir > 0 ? 1 : 1 + motor->asymmetry), motor->step_std_nm);
+	if(step < 0) step = 0;
+	motor->actuator_nm += dir*step;
+	motor->ticks[dir > 0 ? 0 : 1]++;
+
+	double half = motor->backlash_nm/2;
+	if(motor->actuator_nm - motor->position_nm > half) motor->position_nm = motor->actuator_nm - half;
+	if(motor->position_nm - motor->actuator_nm > half) motor->position_nm = motor->actuator_nm + half;
+	SimEncoderUpdate(index);
+}
+void SimPicomotorSwitch(int index, int sw, bool on)
+{
+	// A switch of a motor changes
+	struct sim_picomotor * motor = &SimPicomotor[index];
+	if(on){
+		motor->rise[sw] = SimTime ? SimTime : 1;
+		return;
+	}
+	if(!motor->rise[sw]) return;
+	uint64_t width = SimTime - motor->rise[sw];
+	motor->rise[sw] = 0;
+
+	// HIGH pulse: remembered until the LOW pulse. LOW pulse: tick if the slow pulse was long enough
+	int dir = (sw == SIM_FW_HIGH || sw == SIM_FW_LOW) ? 0 : 1;
+	if(sw == SIM_FW_HIGH || sw == SIM_BW_HIGH){
+		motor->slow[dir] = width ? width : 1;
+		return;
+	}
+	if(!motor->slow[dir]) return;
+	uint64_t slow = (dir == 0) ? motor->slow[dir] : width;
+	motor->slow[dir] = 0;
+
+	if(slow >= SIM_PICO_SLOW_NS && SimPicomotorPowered()) SimPicomotorTick(index, dir == 0 ? 1 : -1);
+	else motor->missed++;
+}
+void SimPicomotorDrive(int port, uint8_t outputs)
+{
+	// New levels of the output pins of an expander port (0 = A, 1 = B)
+	uint8_t changed = outputs ^ SimPicomotorPort[port];
+	SimPicomotorPort[port] = outputs;
+	if(!changed) return;
+
+	for(int II = 0; II < SIM_PICO_COUNT; II++){
+		if(IOEport[II] != 0x12 + port) continue;
+		for(int sw = 0; sw < 4; sw++){
+			uint8_t mask = 1 << IOEpin[4*II + sw];
+			if(changed & mask) SimPicomotorSwitch(II, sw, outputs & mask);
+		}
+	}
+}
+
+#endif /* PICOMOTOR_H_ */
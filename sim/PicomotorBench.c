@@ -0,0 +1,88 @@
+/*
+ * PicomotorBench.c
+ *
+ * Positioning benchmark on the simulator: random moves of one picomotor with SetPicomotorLocation,
+ * against the plant model of Picomotor.h. Reports the convergence time, the number of ticks and the
+ * final error of the moves (one "name value" per line).
+ *
+ * Usage: picomotor_bench [moves] [seed] [motor] [range_nm]
+ */
+
+
+#include "Simulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int CompareDouble(const void * a, const void * b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+void PrintStatistics(const char * name, double * values, int n)
+{
+	// Mean, median, 95th percentile and maximum
+	if(!n) return;
+	qsort(values, n, sizeof(double), CompareDouble);
+	double sum = 0;
+	for(int II = 0; II < n; II++) sum += values[II];
+	printf("%s_mean %.3f\n", name, sum/n);
+	printf("%s_p50 %.3f\n", name, values[n/2]);
+	printf("%s_p95 %.3f\n", name, values[(int)(0.95*(n - 1))]);
+	printf("%s_max %.3f\n", name, values[n - 1]);
+}
+
+int main(int argc, char ** argv)
+{
+	int moves = (argc > 1) ? atoi(argv[1]) : 1000;
+	uint64_t seed = (argc > 2) ? strtoull(argv[2], NULL, 0) : 1;
+	int motor = (argc > 3) ? atoi(argv[3]) : 0;
+	double range = (argc > 4) ? atof(argv[4]) : 5000;
+	if(moves < 1 || motor < 0 || motor >= SIM_PICO_COUNT) return 1;
+	
+	SimSeed(seed);
+	SimInit();
+	int status = PICOMOTOR_ESTIMATION_INIT(100);
+	if(status){
+		printf("init_error %d\n", status);
+		return 1;
+	}
+	
+	double * time_ms = malloc(moves*sizeof(double));
+	double * ticks = malloc(moves*sizeof(double));
+	double * error_nm = malloc(moves*sizeof(double));
+	int done = 0, failed = 0;
+	int failures[256] = {0};
+	
+	struct sim_picomotor * plant = &SimPicomotor[motor];
+	for(int II = 0; II < moves; II++){
+		// Target in [-range, range], from the true position
+		int desired = (int)((2*SimUniform() - 1)*range);
+		int current = (int)lround(plant->position_nm);
+		uint32_t ticks_before = plant->ticks[0] + plant->ticks[1];
+		uint64_t start = SimNow();
+		
+		status = SetPicomotorLocation(motor, current, desired);
+		if(status){
+			failed++;
+			failures[status & 0xFF]++;
+			SimPicomotorPlace(motor, plant->interval_nm/2); // Start the next move from a known place
+			continue;
+		}
+		time_ms[done] = (SimNow() - start)/1e6;
+		ticks[done] = plant->ticks[0] + plant->ticks[1] - ticks_before;
+		error_nm[done] = fabs(plant->position_nm - desired);
+		done++;
+	}
+	
+	printf("moves %d\n", moves);
+	printf("seed %llu\n", (unsigned long long)seed);
+	printf("motor %d\n", motor);
+	printf("succeeded %d\n", done);
+	printf("failed %d\n", failed);
+	for(int II = 0; II < 256; II++) if(failures[II]) printf("failed_code_%d %d\n", II, failures[II]);
+	PrintStatistics("time_ms", time_ms, done);
+	PrintStatistics("ticks", ticks, done);
+	PrintStatistics("abs_error_nm", error_nm, done);
+	printf("missed_pulses %u\n", plant->missed);
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * RegisterTest.c
+ *
+ * Test of the register save (Memory.h) across resets, on the EEPROM model:
+ * - a journaled entry is replayed by the load after a reset;
+ * - after 255 compactions the epoch of the journal comes back: the record 0 left by its previous use must not be
+ *   replayed by a load right after the compaction (compact, reset, load).
+ * - a torn newest snapshot (wrong CRC) falls back to the older slot, counted in memory_REGISTER_CRC_ERRORS and
+ *   memory_REGISTER_FALLBACKS; with both slots torn the load reports INT_EEPROM_EMPTY and the next save recovers.
+ * - the watchdog interrupt saves the register while the main loop is blocked in a code upload (245), and only requests
+ *   the save when it happens during a save of the main loop. The length of the code is only written after its last chunk.
+ * - a null HV_STEP is written as 1.
+ * A reset is modelled by clearing the register in RAM before LoadRegister.
+ * Prints one "name value" per line, then "register_test ok" or the failed checks. Exits with 1 on failure.
+ */
+
+
+#include "Simulator.h"
+#include "Check.h"
+#include <stdio.h>
+
+int Reset(void)
+{
+	// Power cycle: the RAM is lost, the register comes back from the EEPROM
+	memset(REGISTER, 0, sizeof(REGISTER));
+	return LoadRegister(0);
+}
+bool Dirty(uint16_t index)
+{
+	// Entry modified since the last save
+	return REGISTER_DIRTY[index>>3] & (1<<(index&7));
+}
+
+// Upload of two chunks (245), each one after a feedback. The watchdog interrupt fires when the first one is acknowledged:
+// from an erased EEPROM the save is a compaction, the second chunk arrives during it
+uint8_t Reply[MessageN];
+int ReplyLen = 0;
+int UploadFeedbacks = 0;
+int32_t UploadStatus = -1;
+bool SavedInUpload = false;
+uint16_t HeaderInUpload = 0; // Length in the code EEPROM once the first chunk is written
+
+uint16_t CodeHeader(void)
+{
+	return ((uint16_t)SimExtEeprom.memory[0] << 8) | SimExtEeprom.memory[1];
+}
+
+void SendChunk(void * context)
+{
+	uint8_t chunk[EXT_EEPROM_PAGE_SIZE + 2];
+	for(int II = 0; II < EXT_EEPROM_PAGE_SIZE; II++) chunk[II] = II;
+	uint16_t crc = Crc16(0xFFFF, chunk, EXT_EEPROM_PAGE_SIZE);
+	chunk[EXT_EEPROM_PAGE_SIZE] = crc >> 8;
+	chunk[EXT_EEPROM_PAGE_SIZE + 1] = crc;
+	SimUsartSend(0, chunk, sizeof(chunk));
+}
+void UploadHost(int port)
+{
+	ReplyLen += SimUsartReceive(0, Reply + ReplyLen, MessageN - ReplyLen);
+	if(ReplyLen < MessageN) return;
+	ReplyLen = 0;
+	
+	int32_t status = ((int32_t)Reply[1] << 24) | ((int32_t)Reply[2] << 16) | ((int32_t)Reply[3] << 8) | Reply[4];
+	if(Reply[0] != 245) return;
+	UploadFeedbacks++;
+	if(UploadFeedbacks == 1 && status == OK) SendChunk(NULL); // Ready
+	else if(UploadFeedbacks == 2 && status == OK){
+		HeaderInUpload = CodeHeader();
+		WDTCSR |= (1<<WDIF); // Watchdog timeout: interrupt
+		SimSchedule(SimNow() + 300000000ULL, SendChunk, NULL);
+	}
+	else{
+		UploadStatus = status;
+		SavedInUpload = !Dirty(memory_HV_TOL_V) && !WatchdogSave; // Nothing else saves during the command
+	}
+}
+
+int main(void)
+{
+	SimInit();
+	Check("first_load", Reset(), INT_EEPROM_EMPTY);
+
+	// First save: base snapshot. Second save: one record in the journal
+	SetRegister(memory_HV_TOL_V, 31);
+	SaveRegister(0);
+	uint8_t epoch = JournalEpoch;
+	SetRegister(memory_HV_TOL_V, 77);
+	SaveRegister(0);
+	Check("journal_count", JournalCount, 1);
+	Check("journal_load", Reset(), OK);
+	Check("journal_value", REGISTER[memory_HV_TOL_V], 77);
+
+	// Compactions until the epoch of the record comes back, with a newer value in the snapshot
+	SetRegister(memory_HV_TOL_V, 55);
+	int compactions = 0;
+	do{
+		CompactRegister();
+		compactions++;
+	} while(JournalEpoch != epoch && compactions < 1000);
+	Check("compactions", compactions, JOURNAL_ERASED);
+	Check("epoch_journal_count", JournalCount, 0);
+
+	// Reset before any append: the snapshot only
+	Check("epoch_load", Reset(), OK);
+	Check("epoch_journal_replayed", JournalCount, 0);
+	Check("epoch_value", REGISTER[memory_HV_TOL_V], 55);
+
+	// The journal of the epoch works again
+	SetRegister(memory_HV_TOL_V, 66);
+	SaveRegister(0);
+	Check("append_load", Reset(), OK);
+	Check("append_value", REGISTER[memory_HV_TOL_V], 66);
+
+	// Torn newest snapshot (CRC): the older slot is loaded and the fallback counted
+	CompactRegister();
+	uint8_t older = RegisterSlot;
+	int32_t crc_errors = REGISTER[memory_REGISTER_CRC_ERRORS];
+	int32_t fallbacks = REGISTER[memory_REGISTER_FALLBACKS];
+	SetRegister(memory_HV_TOL_V, 44);
+	CompactRegister();
+	Check("torn_slot", RegisterSlot, !older);
+	SimEeprom[RegisterSlot*REGISTER_SLOT_SIZE + 2] ^= 0xFF;
+	Check("torn_load", Reset(), OK);
+	Check("torn_loaded_slot", RegisterSlot, older);
+	Check("torn_value", REGISTER[memory_HV_TOL_V], 66);
+	Check("torn_crc_errors", REGISTER[memory_REGISTER_CRC_ERRORS], crc_errors + 1);
+	Check("torn_fallbacks", REGISTER[memory_REGISTER_FALLBACKS], fallbacks + 1);
+
+	// Both snapshots torn: empty register (no valid slot), the errors counted, the next save works again
+	SimEeprom[older*REGISTER_SLOT_SIZE + 2] ^= 0xFF;
+	Check("both_torn_load", Reset(), INT_EEPROM_EMPTY);
+	Check("both_torn_value", REGISTER[memory_HV_TOL_V], 0);
+	Check("both_torn_crc_errors", REGISTER[memory_REGISTER_CRC_ERRORS], 2);
+	SetRegister(memory_HV_TOL_V, 33);
+	SaveRegister(0);
+	Check("both_torn_saved_load", Reset(), OK);
+	Check("both_torn_saved_value", REGISTER[memory_HV_TOL_V], 33);
+
+	// Watchdog interrupt while the main loop waits for a chunk of an upload: saved from the interrupt
+	SimInit(); // Power on (erased EEPROM, register of SYSTEM_INIT)
+	WATCHDOG_INIT();
+	SetRegister(memory_HV_TOL_V, 88);
+	SimUsartHost = UploadHost;
+	uint8_t upload[MessageN] = {245, 0, 0, 0, 2*EXT_EEPROM_PAGE_SIZE};
+	SimUsartSend(0, upload, MessageN);
+	SimRun(2000000000ULL);
+	SimUsartHost = NULL;
+	SimWatchdogDisable();
+	Check("wdt_upload_status", UploadStatus, OK);
+	Check("upload_header_running", HeaderInUpload, EXT_EEPROM_NO_CODE);
+	Check("upload_header_done", CodeHeader(), 2*EXT_EEPROM_PAGE_SIZE);
+	Check("wdt_saved_in_upload", SavedInUpload, true);
+	Check("wdt_upload_load", Reset(), OK);
+	Check("wdt_upload_value", REGISTER[memory_HV_TOL_V], 88);
+
+	// Watchdog interrupt during a save of the main loop: only requested, then served once the save is over
+	SetRegister(memory_HV_TOL_V, 99);
+	SaveInProgress++;
+	WDT_vect();
+	Check("wdt_guard_requested", WatchdogSave, true);
+	Check("wdt_guard_dirty", Dirty(memory_HV_TOL_V), true);
+	CheckWatchdogSave();
+	Check("wdt_guard_held", WatchdogSave, true);
+	SaveInProgress--;
+	CheckWatchdogSave();
+	Check("wdt_guard_served", WatchdogSave || Dirty(memory_HV_TOL_V), false);
+	Check("wdt_guard_load", Reset(), OK);
+	Check("wdt_guard_value", REGISTER[memory_HV_TOL_V], 99);
+
+	// A null HV step is clamped by SetRegister: the ramp would never reach its target
+	SetRegister(memory_HV_STEP, 0);
+	Check("hv_step_zero", REGISTER[memory_HV_STEP], 1);
+
+	printf(Failures ? "register_test FAILED (%d)\n" : "register_test ok\n", Failures);
+	fflush(NULL); // stdout is the stream of the firmware here (SimHal.h)
+	return Failures ? 1 : 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * SimHal.h
+ *
+ * Hardware access of Hal.h on the host. The functions are defined by the simulator (sim/Simulator.h):
+ * each one runs the peripheral model and lets the virtual time run for the duration of the transfer.
+ */
+
+
+#ifndef SIM_HAL_H_
+#define SIM_HAL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// USART
+void HAL_USART0_TX(uint8_t byte);
+void HAL_USART1_TX(uint8_t byte);
+
+// SPI
+uint8_t HAL_SPI_TRANSFER(uint8_t byte);
+void SimSpiEnd(void);
+#define HAL_SPI_END() SimSpiEnd()
+
+// TWI
+void HAL_TWI(uint8_t control);
+void HAL_TWI_STOP(void);
+
+// ADC
+uint16_t HAL_ADC_CONVERT(void);
+
+// TIME
+void SimPoll(void);
+#define HAL_POLL() SimPoll()
+uint16_t HAL_TIMER1_COUNT(void);
+
+// The avr-libc output streams (printf over USART0) are not used on the host
+#define _FDEV_SETUP_WRITE 0
+#define FDEV_SETUP_STREAM(put, get, flags) {0}
+extern FILE * SimStdout;
+#undef stdout
+#define stdout SimStdout
+
+#endif /* SIM_HAL_H_ */
@@ -0,0 +1,62 @@
+/*
+ * Simulator.c
+ *
+ * Host build of the firmware against the simulator (see Simulator.h and sim/Makefile).
+ * Runs a short session: power on, PING and register read on USART0, one hour of idle time (fast-forwarded),
+ * then prints the replies with the virtual time they took.
+ */
+
+
+#include "Simulator.h"
+#include <stdio.h>
+#include <time.h>
+
+void SendMessage(int port, uint8_t command, int32_t data)
+{
+	// Legacy message: command + data (MSB first)
+	uint8_t message[MessageN] = {command, data >> 24, data >> 16, data >> 8, data};
+	SimUsartSend(port, message, MessageN);
+}
+void PrintReply(const char * name, uint64_t start)
+{
+	uint8_t reply[64];
+	int len = SimUsartReceive(0, reply, sizeof(reply));
+	printf("%-14s", name);
+	for(int II = 0; II < len; II++) printf(" %02X", reply[II]);
+	printf("  (%.3f ms)\n", (SimNow() - start)/1e6);
+}
+
+int main(void)
+{
+	clock_t wall = clock();
+	
+	SimInit();
+	printf("initialization  %.3f ms\n", SimNow()/1e6);
+	
+	uint64_t start = SimNow();
+	SendMessage(0, 255, 0x12345678);
+	SimRun(20000000);
+	PrintReply("PING", start);
+	
+	start = SimNow();
+	SendMessage(0, 150, memory_USART0_BAUD);
+	SimRun(20000000);
+	PrintReply("REGISTER READ", start);
+	
+	start = SimNow();
+	SendMessage(0, 214 + 1, 0);
+	SimRun(20000000);
+	PrintReply("WRONG COMMAND", start);
+	
+	// One hour without message (the error of the wrong command is written to the EEPROM after ERROR_FLUSH_MS)
+	SimRun(3600000000000ULL);
+	printf("idle hour       %lu ticks, %lu EEPROM bytes written\n", (unsigned long)GetTicks(), (unsigned long)SimEepromWrites);
+	
+	start = SimNow();
+	SendMessage(0, 255, 0);
+	SimRun(20000000);
+	PrintReply("PING", start);
+	
+	printf("virtual time    %.3f s, wall time %.3f ms, %lu events\n", SimNow()/1e9, 1000.0*(clock() - wall)/CLOCKS_PER_SEC, (unsigned long)SimEventsRun);
+	return 0;
+}
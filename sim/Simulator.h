@@ -0,0 +1,910 @@
+/*
+ * Simulator.h
+ *
+ * Host simulator of the board: the firmware (main.c) runs on Linux against models of its peripherals.
+ * The firmware is linked from its objects, built with -DSIMULATOR (main of main.c renamed FirmwareMain, see
+ * Makefile). The registers of avr/io.h are plain variables, defined here: the models
+ * read the configuration the firmware writes and answer through the Hal.h functions.
+ *
+ * The time is virtual (SimNow, in ns, see Clock.h). It only runs in the delays, in the transfers (USART, SPI,
+ * TWI, ADC, EEPROM) at the speed of the bus, and by SIM_POLL_NS each time the firmware polls a flag or the time.
+ * The code itself takes no time (a profiling build only measures these times, see Profiler.h). The interrupts
+ * (Timer0 tick, Timer1 overflow, USART RX, watchdog) are called when the time reaches them and the global
+ * interrupt flag is set. When the main loop has nothing to do, SimRun jumps to the next event (fast-forward).
+ *
+ * Models:
+ * - USART0/USART1: bytes sent by the host at the baud rate set by the firmware, bytes sent by the firmware
+ *   captured with the time they end (SimUsartHost is called then, for a host that answers).
+ * - SPI: MCP23S17 I/O expander (picomotors) and the HV/bias DACs (14-bit code latched when CS rises).
+ * - TWI: MAX6956 multiplexers (0x98, 0x84), MCP9801 (0x9E), TMP006 (0x80, 0x82, 0x88) and the code
+ *   EEPROM (0xA0, 16 KB, 64-byte pages, busy during the write cycle).
+ * - Picomotors and encoders (Picomotor.h), driven by the expander outputs.
+ * - HV supply and electrodes (Electrodes.h), driven by the DACs and the multiplexers.
+ * - XBee radio on USART1 (XBee.h): byte pipe, or API frames (TX status, AT responses, RF packets).
+ * - ADC: one value per channel, set by the host (HV feedback from the model). GPIO inputs (faults, separation device): SimSetPin.
+ * - Internal EEPROM (4 KB, erased) and watchdog.
+ * Note: int is 32 bits on the host (16 bits on the AVR).
+ */
+
+
+#ifndef SIMULATOR_H_
+#define SIMULATOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "Algorithms.h" // Declarations of the firmware (Memory.h, Interfaces.h, Drivers.h)
+#include "Clock.h"
+
+/*--------------------------------------------------
+                     FIRMWARE
+--------------------------------------------------*/
+void SYSTEM_INIT(void); // main.c
+void SystemUpdate(void); // main.c
+
+// Interrupt routines (ISR)
+void WDT_vect(void); // main.c
+void TIMER0_COMPA_vect(void); // Interfaces.c
+void USART0_RX_vect(void); // Interfaces.c
+void USART1_RX_vect(void); // Interfaces.c
+#ifdef PROFILE
+void TIMER1_OVF_vect(void); // Profiler.c
+#endif
+
+/*--------------------------------------------------
+                     PARAMETERS
+--------------------------------------------------*/
+#define SIM_POLL_NS 1000 // Time of one poll of a flag or of the time [ns]
+#define SIM_USART_CAPTURE_SIZE 4096 // Bytes sent by the firmware kept per port (power of 2)
+#define SIM_USART_QUEUE_SIZE 4096 // Bytes waiting to be received per port (power of 2)
+#define SIM_EEPROM_SIZE (E2END + 1) // Internal EEPROM [bytes]
+#define SIM_EEPROM_WRITE_NS 3300000 // Programming time of one byte of the internal EEPROM [ns]
+#define SIM_EXT_EEPROM_SIZE (EXT_EEPROM_MAX_ADDR + 1) // Code EEPROM [bytes]
+#define SIM_EXT_EEPROM_WRITE_NS 5000000 // Write cycle of the code EEPROM [ns]
+#define SIM_ADC_CHANNELS 8
+#define SIM_TWI_DEVICES 8
+
+/*--------------------------------------------------
+                     REGISTERS
+--------------------------------------------------*/
+volatile uint8_t SREG;
+volatile uint8_t DDRA, PORTA, PINA, DDRB, PORTB, PINB, DDRC, PORTC, PINC, DDRD, PORTD, PIND;
+volatile uint8_t UDR0, UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+volatile uint8_t UDR1, UCSR1A, UCSR1B, UCSR1C, UBRR1H, UBRR1L;
+volatile uint8_t SPCR, SPSR, SPDR;
+volatile uint8_t TWBR, TWCR, TWSR, TWDR;
+volatile uint8_t ADMUX, ADCSRA, ADCL, ADCH, DIDR0;
+volatile uint8_t WDTCSR;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, TIMSK0, TIFR0;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t TCNT1;
+
+FILE * SimStdout;
+
+void SimAdvance(uint64_t ns);
+void SimInterrupts(void);
+void SimPicomotorDrive(int port, uint8_t outputs);
+void SimElectrodesUpdate(void);
+void SimElectrodeSwitches(void);
+void SimXBeeTransmit(uint8_t byte, uint64_t time);
+
+/*--------------------------------------------------
+                      TIMER 0
+--------------------------------------------------*/
+// The compare matches are not events: they are counted when the time moves (SimTimersCatchUp)
+uint64_t SimTimer0Next = 0; // Time of the next compare match (0 = timer stopped)
+
+uint64_t SimTimer0Period(void)
+{
+	// Period of the compare match in CTC mode [ns] (0 if the timer is stopped)
+	const uint16_t prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+	uint16_t prescaler = prescalers[TCCR0B & 7];
+	if(!prescaler || !(TCCR0A & (1<<WGM01))) return 0;
+	return SimCycles((uint64_t)prescaler*(OCR0A + 1));
+}
+void SimTimer0Update(void)
+{
+	// Start the timer when configured, and keep TCNT0 for GetMicros
+	uint64_t period = SimTimer0Period();
+	if(!period){
+		SimTimer0Next = 0;
+		return;
+	}
+	if(!SimTimer0Next) SimTimer0Next = SimTime + period;
+	TCNT0 = (uint8_t)((OCR0A + 1) - (SimTimer0Next - SimTime)*(OCR0A + 1)/period);
+}
+uint64_t SimTickTime(uint32_t tick)
+{
+	// Time at which TimerTicks reaches tick (SIM_NEVER if the timer is stopped)
+	if(!SimTimer0Next) return SIM_NEVER;
+	if((int32_t)(tick - TimerTicks) <= 0) return SimTime;
+	return SimTimer0Next + (uint64_t)(tick - TimerTicks - 1)*SimTimer0Period();
+}
+
+/*--------------------------------------------------
+                      TIMER 1
+--------------------------------------------------*/
+// Free-running counter (normal mode), the cycle counter of the profiler. The overflows are counted like the
+// compare matches of Timer0. TIMER1_OVF_vect only exists in the profiling builds (Profiler.h).
+
+uint64_t SimTimer1Start = 0; // Time the count was 0
+uint64_t SimTimer1Next = 0; // Time of the next overflow (0 = timer stopped)
+
+uint32_t SimTimer1Prescaler(void)
+{
+	const uint16_t prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+	return prescalers[TCCR1B & 7];
+}
+void SimTimer1Update(void)
+{
+	// Start the timer from TCNT1 when configured
+	uint32_t prescaler = SimTimer1Prescaler();
+	if(!prescaler){
+		SimTimer1Next = 0;
+		return;
+	}
+	if(!SimTimer1Next){
+		SimTimer1Start = SimTime - SimCycles((uint64_t)prescaler*TCNT1);
+		SimTimer1Next = SimTimer1Start + SimCycles(65536ULL*prescaler);
+	}
+}
+uint16_t HAL_TIMER1_COUNT(void)
+{
+	SimTimer1Update();
+	if(!SimTimer1Next) return TCNT1;
+	TCNT1 = (SimTime - SimTimer1Start)*F_CPU/1000000000ULL/SimTimer1Prescaler();
+	return TCNT1;
+}
+
+/*--------------------------------------------------
+                      TIMERS
+--------------------------------------------------*/
+void SimTimersCatchUp(uint64_t time)
+{
+	// Compare matches of Timer0 and overflows of Timer1 until time, in order: one interrupt each
+	// (a match while the interrupts are disabled stays pending)
+	SimTimer0Update();
+	SimTimer1Update();
+	while(1){
+		uint64_t next0 = SimTimer0Next ? SimTimer0Next : SIM_NEVER;
+		uint64_t next1 = SimTimer1Next ? SimTimer1Next : SIM_NEVER;
+		if(next0 > time && next1 > time) return;
+
+		if(next1 < next0){
+			SimTime = SimTimer1Start = next1;
+			SimTimer1Next += SimCycles(65536ULL*SimTimer1Prescaler());
+			TIFR1 |= (1<<TOV1);
+		}
+		else{
+			SimTime = next0;
+			SimTimer0Next += SimTimer0Period();
+			TIFR0 |= (1<<OCF0A);
+		}
+		SimInterrupts();
+	}
+}
+
+/*--------------------------------------------------
+                     WATCHDOG
+--------------------------------------------------*/
+uint64_t SimWatchdogEvent = 0; // Event of the timeout (0 = stopped)
+uint32_t SimWatchdogResets = 0; // Number of system resets the watchdog would have done
+
+void SimWatchdogTimeout(void * context);
+
+uint64_t SimWatchdogPeriod(void)
+{
+	// 2048 cycles of the 128kHz oscillator (16ms) times 2^WDP
+	uint8_t wdp = (WDTCSR & 7) | ((WDTCSR & (1<<WDP3)) ? 8 : 0);
+	return 16000000ULL << wdp;
+}
+void SimWatchdogReset(void)
+{
+	if(SimWatchdogEvent) SimCancel(SimWatchdogEvent);
+	SimWatchdogEvent = (WDTCSR & ((1<<WDE) | (1<<WDIE))) ? SimSchedule(SimTime + SimWatchdogPeriod(), SimWatchdogTimeout, NULL) : 0;
+}
+void SimWatchdogUpdate(void)
+{
+	// Start the timeout when the watchdog is configured (WDTCSR written by the firmware)
+	if(!SimWatchdogEvent && (WDTCSR & ((1<<WDE) | (1<<WDIE)))) SimWatchdogReset();
+}
+void SimWatchdogDisable(void)
+{
+	WDTCSR &= ~((1<<WDE) | (1<<WDIE));
+	if(SimWatchdogEvent) SimCancel(SimWatchdogEvent);
+	SimWatchdogEvent = 0;
+}
+void SimWatchdogTimeout(void * context)
+{
+	// Interrupt first (WDIE), then system reset (WDE)
+	SimWatchdogEvent = 0;
+	if(WDTCSR & (1<<WDIE)) WDTCSR |= (1<<WDIF);
+	else SimWatchdogResets++;
+	SimWatchdogReset();
+}
+
+/*--------------------------------------------------
+                       USART
+--------------------------------------------------*/
+struct sim_usart{
+	volatile uint8_t * udr;
+	volatile uint8_t * ucsra;
+	volatile uint8_t * ucsrb;
+	volatile uint8_t * ucsrc;
+	volatile uint8_t * ubrrh;
+	volatile uint8_t * ubrrl;
+	void (*rx_vect)(void);
+
+	// Bytes sent by the host: byte and time it is received (one event for the next byte)
+	uint8_t rx[SIM_USART_QUEUE_SIZE];
+	uint64_t rx_time[SIM_USART_QUEUE_SIZE];
+	uint32_t rx_head, rx_tail;
+	uint64_t rx_line; // End of the last byte on the line
+	bool rx_scheduled;
+
+	// Bytes sent by the firmware: byte and time it is sent
+	uint8_t tx[SIM_USART_CAPTURE_SIZE];
+	uint64_t tx_time[SIM_USART_CAPTURE_SIZE];
+	uint32_t tx_head, tx_tail;
+	uint64_t tx_line; // End of the last byte on the line
+	uint32_t tx_lost; // Bytes dropped because the host did not read them
+};
+struct sim_usart SimUsart[2] = {
+	{&UDR0, &UCSR0A, &UCSR0B, &UCSR0C, &UBRR0H, &UBRR0L, USART0_RX_vect},
+	{&UDR1, &UCSR1A, &UCSR1B, &UCSR1C, &UBRR1H, &UBRR1L, USART1_RX_vect}
+};
+
+uint64_t SimUsartByteTime(int port)
+{
+	// Start bit + 8 data bits + stop bit(s), at the baud rate set in UBRR (and U2X)
+	struct sim_usart * usart = &SimUsart[port];
+	uint32_t ubrr = ((*usart->ubrrh & 0x0F) << 8) | *usart->ubrrl;
+	uint32_t div = (*usart->ucsra & (1<<U2X0)) ? 8 : 16;
+	uint32_t bits = (*usart->ucsrc & (1<<USBS0)) ? 11 : 10;
+	return SimCycles((uint64_t)bits*div*(ubrr + 1));
+}
+void SimUsartReceived(void * context);
+void SimUsartSchedule(struct sim_usart * usart)
+{
+	// Event for the next byte received
+	if(usart->rx_scheduled || usart->rx_tail == usart->rx_head) return;
+	usart->rx_scheduled = SimSchedule(usart->rx_time[usart->rx_tail & (SIM_USART_QUEUE_SIZE - 1)], SimUsartReceived, usart);
+}
+void SimUsartSend(int port, const uint8_t * data, int len)
+{
+	// The host sends bytes to the firmware, back to back
+	struct sim_usart * usart = &SimUsart[port];
+	for(int II = 0; II < len; II++){
+		if(usart->rx_head - usart->rx_tail == SIM_USART_QUEUE_SIZE) break;
+		if(usart->rx_line < SimTime) usart->rx_line = SimTime;
+		usart->rx_line += SimUsartByteTime(port);
+		usart->rx[usart->rx_head & (SIM_USART_QUEUE_SIZE - 1)] = data[II];
+		usart->rx_time[usart->rx_head & (SIM_USART_QUEUE_SIZE - 1)] = usart->rx_line;
+		usart->rx_head++;
+	}
+	SimUsartSchedule(usart);
+}
+int SimUsartReceive(int port, uint8_t * data, int max_len)
+{
+	// Bytes sent by the firmware so far (at most max_len)
+	struct sim_usart * usart = &SimUsart[port];
+	int len = 0;
+	while(len < max_len && usart->tx_tail != usart->tx_head && usart->tx_time[usart->tx_tail & (SIM_USART_CAPTURE_SIZE - 1)] <= SimTime){
+		data[len++] = usart->tx[usart->tx_tail & (SIM_USART_CAPTURE_SIZE - 1)];
+		usart->tx_tail++;
+	}
+	return len;
+}
+void (*SimUsartHost)(int port) = NULL; // Called when a byte sent by the firmware has reached the host (if set)
+
+void SimUsartDelivered(void * context)
+{
+	struct sim_usart * usart = context;
+	if(SimUsartHost) SimUsartHost(usart - SimUsart);
+}
+void SimUsartTransmit(int port, uint8_t byte)
+{
+	// The data register is free once the previous byte started: wait for it, then queue the byte on the line
+	struct sim_usart * usart = &SimUsart[port];
+	if(!(*usart->ucsrb & (1<<TXEN0))) return;
+	uint64_t byte_time = SimUsartByteTime(port);
+	if(usart->tx_line > SimTime + byte_time) SimAdvance(usart->tx_line - byte_time - SimTime);
+
+	if(usart->tx_line < SimTime) usart->tx_line = SimTime;
+	usart->tx_line += byte_time;
+	if(usart->tx_head - usart->tx_tail == SIM_USART_CAPTURE_SIZE){
+		usart->tx_tail++;
+		usart->tx_lost++;
+	}
+	usart->tx[usart->tx_head & (SIM_USART_CAPTURE_SIZE - 1)] = byte;
+	usart->tx_time[usart->tx_head & (SIM_USART_CAPTURE_SIZE - 1)] = usart->tx_line;
+	usart->tx_head++;
+	if(port == 1) SimXBeeTransmit(byte, usart->tx_line);
+	if(SimUsartHost) SimSchedule(usart->tx_line, SimUsartDelivered, usart);
+}
+void HAL_USART0_TX(uint8_t byte)
+{
+	SimUsartTransmit(0, byte);
+}
+void HAL_USART1_TX(uint8_t byte)
+{
+	SimUsartTransmit(1, byte);
+}
+void SimUsartReceived(void * context)
+{
+	// A byte is received: into UDR with RXC set, lost if the previous one was not read (overrun)
+	struct sim_usart * usart = context;
+	uint8_t byte = usart->rx[usart->rx_tail & (SIM_USART_QUEUE_SIZE - 1)];
+	usart->rx_tail++;
+	usart->rx_scheduled = false;
+	SimUsartSchedule(usart);
+	if(!(*usart->ucsrb & (1<<RXEN0))) return;
+
+	if(*usart->ucsra & (1<<RXC0)) *usart->ucsra |= (1<<DOR0);
+	else{
+		*usart->udr = byte;
+		*usart->ucsra |= (1<<RXC0);
+	}
+}
+
+/*--------------------------------------------------
+                    INTERRUPTS
+--------------------------------------------------*/
+void SimInterrupt(void (*vector)(void), bool nested)
+{
+	// Run an interrupt routine (the global interrupt flag is cleared unless ISR_NOBLOCK)
+	uint8_t sreg = SREG;
+	if(!nested) SREG &= ~(1<<7);
+	vector();
+	SREG = sreg;
+}
+void SimInterrupts(void)
+{
+	// Pending interrupts, in the order of the vector table
+	if(!(SREG & (1<<7))) return;
+
+	if((WDTCSR & (1<<WDIF)) && (WDTCSR & (1<<WDIE))){
+		WDTCSR &= ~((1<<WDIF) | (1<<WDIE)); // The hardware clears WDIE: the next timeout resets the system
+		SimInterrupt(WDT_vect, true); // ISR_NOBLOCK (main.c)
+	}
+#ifdef PROFILE
+	if((TIFR1 & (1<<TOV1)) && (TIMSK1 & (1<<TOIE1))){
+		TIFR1 &= ~(1<<TOV1);
+		SimInterrupt(TIMER1_OVF_vect, false);
+	}
+#endif
+	if((TIFR0 & (1<<OCF0A)) && (TIMSK0 & (1<<OCIE0A))){
+		TIFR0 &= ~(1<<OCF0A);
+		SimInterrupt(TIMER0_COMPA_vect, false);
+	}
+	for(int port = 0; port < 2; port++){
+		struct sim_usart * usart = &SimUsart[port];
+		if((*usart->ucsra & (1<<RXC0)) && (*usart->ucsrb & (1<<RXCIE0))){
+			SimInterrupt(usart->rx_vect, false);
+			*usart->ucsra &= ~((1<<RXC0) | (1<<DOR0) | (1<<FE0) | (1<<UPE0)); // UDR was read
+		}
+	}
+}
+
+/*--------------------------------------------------
+                  TIME ADVANCE
+--------------------------------------------------*/
+void SimAdvance(uint64_t ns)
+{
+	// Let the time run, running the events (and the timer ticks) on the way
+	// A model may call it again from an event or an interrupt: the time only moves forward
+	uint64_t end = SimTime + ns;
+	SimWatchdogUpdate();
+	while(SimNextEvent() <= end){
+		SimTimersCatchUp(SimNextEvent());
+		SimRunEvent(end);
+		SimInterrupts();
+	}
+	SimTimersCatchUp(end);
+	if(end > SimTime) SimTime = end;
+	SimTimer0Update();
+	SimTimer1Update();
+	SimInterrupts();
+}
+void SimPoll(void)
+{
+	SimAdvance(SIM_POLL_NS);
+}
+void _delay_us(double us)
+{
+	SimAdvance((uint64_t)(us*1000));
+}
+void _delay_ms(double ms)
+{
+	SimAdvance((uint64_t)(ms*1000000));
+}
+
+/*--------------------------------------------------
+                  INTERNAL EEPROM
+--------------------------------------------------*/
+uint8_t SimEeprom[SIM_EEPROM_SIZE];
+uint32_t SimEepromWrites = 0; // Number of bytes programmed
+
+uint8_t SimEepromRead(const void * addr)
+{
+	return SimEeprom[(uintptr_t)addr % SIM_EEPROM_SIZE];
+}
+void SimEepromWrite(void * addr, uint8_t value, bool update)
+{
+	// The CPU waits for the end of the programming of the byte
+	uint8_t * cell = &SimEeprom[(uintptr_t)addr % SIM_EEPROM_SIZE];
+	if(update && *cell == value) return;
+	*cell = value;
+	SimEepromWrites++;
+	SimAdvance(SIM_EEPROM_WRITE_NS);
+}
+uint8_t eeprom_read_byte(const uint8_t * addr)
+{
+	return SimEepromRead(addr);
+}
+uint16_t eeprom_read_word(const uint16_t * addr)
+{
+	uint16_t value;
+	eeprom_read_block(&value, addr, 2);
+	return value;
+}
+uint32_t eeprom_read_dword(const uint32_t * addr)
+{
+	uint32_t value;
+	eeprom_read_block(&value, addr, 4);
+	return value;
+}
+void eeprom_read_block(void * dst, const void * src, size_t n)
+{
+	for(size_t II = 0; II < n; II++) ((uint8_t *)dst)[II] = SimEepromRead((const uint8_t *)src + II);
+}
+void eeprom_write_block(const void * src, void * dst, size_t n)
+{
+	for(size_t II = 0; II < n; II++) SimEepromWrite((uint8_t *)dst + II, ((const uint8_t *)src)[II], false);
+}
+void eeprom_update_block(const void * src, void * dst, size_t n)
+{
+	for(size_t II = 0; II < n; II++) SimEepromWrite((uint8_t *)dst + II, ((const uint8_t *)src)[II], true);
+}
+void eeprom_write_byte(uint8_t * addr, uint8_t value) {eeprom_write_block(&value, addr, 1);}
+void eeprom_write_word(uint16_t * addr, uint16_t value) {eeprom_write_block(&value, addr, 2);}
+void eeprom_write_dword(uint32_t * addr, uint32_t value) {eeprom_write_block(&value, addr, 4);}
+void eeprom_update_byte(uint8_t * addr, uint8_t value) {eeprom_update_block(&value, addr, 1);}
+void eeprom_update_word(uint16_t * addr, uint16_t value) {eeprom_update_block(&value, addr, 2);}
+void eeprom_update_dword(uint32_t * addr, uint32_t value) {eeprom_update_block(&value, addr, 4);}
+
+/*--------------------------------------------------
+                       GPIO
+--------------------------------------------------*/
+void SimSetPin(volatile uint8_t * pin, int bit, bool level)
+{
+	// Level applied on an input pin (PINx register)
+	if(level) *pin |= (1<<bit);
+	else *pin &= ~(1<<bit);
+}
+
+/*--------------------------------------------------
+                        SPI
+--------------------------------------------------*/
+// MCP23S17 (BANK = 0 addresses)
+#define SIM_IODIRA 0x00
+#define SIM_IODIRB 0x01
+#define SIM_GPIOA 0x12
+#define SIM_GPIOB 0x13
+#define SIM_OLATA 0x14
+#define SIM_OLATB 0x15
+
+struct sim_expander{
+	uint8_t reg[0x16];
+	uint8_t input[2]; // Levels applied on the input pins of port A and B
+	int index; // Byte of the frame (0 = opcode, 1 = register address, then data)
+	bool read;
+	uint8_t address;
+	uint32_t writes; // Number of writes to the output latches
+};
+struct sim_expander SimExpander;
+
+struct sim_dac{
+	uint16_t code; // 14-bit code latched
+	uint16_t shift; // Bits received in the frame
+	int index; // Bytes received in the frame
+	uint64_t time; // Time the code was latched
+};
+struct sim_dac SimDac[2]; // SELECT_HV - 1, SELECT_BIAS - 1
+
+uint64_t SimSpiByteTime(void)
+{
+	// SCK = F_CPU/4, 16, 64 or 128 (twice as fast with SPI2X)
+	const uint8_t div[4] = {4, 16, 64, 128};
+	uint32_t d = div[SPCR & 3];
+	if(SPSR & (1<<SPI2X)) d /= 2;
+	return SimCycles(8*d);
+}
+uint8_t SimExpanderTransfer(uint8_t byte)
+{
+	// Opcode (0100 A2 A1 A0 R/W), register address, then data (address incremented)
+	struct sim_expander * e = &SimExpander;
+	uint8_t out = 0;
+	if(e->index == 0) e->read = byte & 1;
+	else if(e->index == 1) e->address = byte;
+	else{
+		if(e->address < sizeof(e->reg)){
+			if(e->read){
+				if(e->address == SIM_GPIOA || e->address == SIM_GPIOB){
+					int port = e->address - SIM_GPIOA;
+					uint8_t dir = e->reg[SIM_IODIRA + port];
+					out = (e->reg[SIM_OLATA + port] & ~dir) | (e->input[port] & dir);
+				}
+				else out = e->reg[e->address];
+			}
+			else{
+				if(e->address == SIM_GPIOA || e->address == SIM_GPIOB) e->address += SIM_OLATA - SIM_GPIOA; // Writing GPIO writes the latch
+				e->reg[e->address] = byte;
+				if(e->address == SIM_OLATA || e->address == SIM_OLATB) e->writes++;
+				
+				// Levels of the output pins (to the picomotor drivers)
+				if(e->address <= SIM_IODIRB || e->address >= SIM_OLATA){
+					int port = e->address & 1;
+					SimPicomotorDrive(port, e->reg[SIM_OLATA + port] & ~e->reg[SIM_IODIRA + port]);
+				}
+			}
+		}
+		e->address++;
+	}
+	e->index++;
+	return out;
+}
+void SimDacTransfer(struct sim_dac * dac, uint8_t byte)
+{
+	dac->shift = (dac->shift << 8) | byte;
+	dac->index++;
+}
+uint8_t HAL_SPI_TRANSFER(uint8_t byte)
+{
+	// The selected devices (CS low) receive the byte
+	SimAdvance(SimSpiByteTime());
+	if(!(SPCR & (1<<SPE))) return 0;
+
+	uint8_t miso = 0;
+	if(!(PORT_SS_PICO & (1<<SS_PICO))) miso = SimExpanderTransfer(byte);
+	if(!(PORT_SS_HV & (1<<SS_HV))) SimDacTransfer(&SimDac[0], byte);
+	if(!(PORT_SS_BIAS & (1<<SS_BIAS))) SimDacTransfer(&SimDac[1], byte);
+	SPDR = miso;
+	return miso;
+}
+void SimSpiEnd(void)
+{
+	// CS rises: end of the frames. A DAC latches its code after a full 16-bit word
+	SimExpander.index = 0;
+	for(int II = 0; II < 2; II++){
+		if(SimDac[II].index == 2){
+			SimElectrodesUpdate();
+			SimDac[II].code = SimDac[II].shift & 0x3FFF;
+			SimDac[II].time = SimTime;
+		}
+		SimDac[II].index = 0;
+	}
+}
+
+/*--------------------------------------------------
+                        TWI
+--------------------------------------------------*/
+// A device answers its address: start of a transfer (read or write), bytes, stop
+struct sim_twi_device{
+	uint8_t address; // 8-bit address (R/W bit = 0)
+	void * state;
+	bool (*start)(void * state, bool read); // false = address not acknowledged
+	bool (*write)(void * state, uint8_t byte); // false = byte not acknowledged
+	uint8_t (*read)(void * state);
+	void (*stop)(void * state);
+};
+struct sim_twi_device SimTwiDevices[SIM_TWI_DEVICES];
+int SimTwiCount = 0;
+struct sim_twi_device * SimTwiSelected = NULL; // Device addressed in the current transfer
+bool SimTwiStarted = false; // START sent, waiting for the address
+bool SimTwiBusy = false; // Between START and STOP
+
+void SimTwiAttach(uint8_t address, void * state, bool (*start)(void *, bool), bool (*write)(void *, uint8_t), uint8_t (*read)(void *), void (*stop)(void *))
+{
+	if(SimTwiCount == SIM_TWI_DEVICES) return;
+	SimTwiDevices[SimTwiCount++] = (struct sim_twi_device){address & 0xFE, state, start, write, read, stop};
+}
+uint64_t SimTwiBitTime(void)
+{
+	// SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS)
+	return SimCycles(16 + 2ULL*TWBR*(1 << (2*(TWSR & 3))));
+}
+void SimTwiStatus(uint8_t status)
+{
+	TWSR = status | (TWSR & 3);
+	TWCR |= (1<<TWINT);
+}
+void HAL_TWI(uint8_t control)
+{
+	TWCR = control & ~(1<<TWINT);
+	if(!(control & (1<<TWEN))) return;
+
+	// START (or repeated START)
+	if(control & (1<<TWSTA)){
+		SimAdvance(SimTwiBitTime());
+		if(SimTwiSelected && SimTwiSelected->stop) SimTwiSelected->stop(SimTwiSelected->state);
+		SimTwiSelected = NULL;
+		SimTwiStatus(SimTwiBusy ? TW_REP_START : TW_START);
+		SimTwiStarted = SimTwiBusy = true;
+		return;
+	}
+
+	// Byte transfer (address, data sent or data received): 8 bits + acknowledge
+	SimAdvance(9*SimTwiBitTime());
+	if(SimTwiStarted){
+		SimTwiStarted = false;
+		bool read = TWDR & 1;
+		for(int II = 0; II < SimTwiCount; II++){
+			struct sim_twi_device * device = &SimTwiDevices[II];
+			if(device->address == (TWDR & 0xFE) && (!device->start || device->start(device->state, read))) SimTwiSelected = device;
+		}
+		if(read) SimTwiStatus(SimTwiSelected ? TW_MR_SLA_ACK : TW_MR_SLA_NACK);
+		else SimTwiStatus(SimTwiSelected ? TW_MT_SLA_ACK : TW_MT_SLA_NACK);
+	}
+	else if((TW_STATUS == TW_MR_SLA_ACK) || (TW_STATUS == TW_MR_DATA_ACK)){
+		TWDR = (SimTwiSelected && SimTwiSelected->read) ? SimTwiSelected->read(SimTwiSelected->state) : 0xFF;
+		SimTwiStatus((control & (1<<TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
+	}
+	else if((TW_STATUS == TW_MT_SLA_ACK) || (TW_STATUS == TW_MT_DATA_ACK)){
+		bool ack = SimTwiSelected && (!SimTwiSelected->write || SimTwiSelected->write(SimTwiSelected->state, TWDR));
+		SimTwiStatus(ack ? TW_MT_DATA_ACK : TW_MT_DATA_NACK);
+	}
+	else SimTwiStatus(TW_BUS_ERROR);
+}
+void HAL_TWI_STOP(void)
+{
+	SimAdvance(SimTwiBitTime());
+	if(SimTwiSelected && SimTwiSelected->stop) SimTwiSelected->stop(SimTwiSelected->state);
+	SimTwiSelected = NULL;
+	SimTwiStarted = SimTwiBusy = false;
+	TWCR &= ~(1<<TWSTO);
+	TWSR = TW_NO_INFO | (TWSR & 3);
+}
+
+// MAX6956 multiplexer: command byte (auto-incremented), then data
+struct sim_max6956{
+	uint8_t reg[0x60];
+	uint8_t pointer;
+	int index; // Bytes written in the transfer
+};
+struct sim_max6956 SimMultiplexer[2]; // MPaddr
+
+bool SimMax6956Start(void * state, bool read)
+{
+	((struct sim_max6956 *)state)->index = 0;
+	return true;
+}
+bool SimMax6956Write(void * state, uint8_t byte)
+{
+	struct sim_max6956 * mux = state;
+	if(mux->index++ == 0){
+		mux->pointer = byte & 0x7F;
+		return true;
+	}
+
+	// Ports 4-31: one register per port (0x24-0x3F), and one register for 8 ports (0x44-0x5F)
+	uint8_t p = mux->pointer;
+	SimElectrodesUpdate();
+	if(p < sizeof(mux->reg)) mux->reg[p] = byte;
+	if(p >= 0x44 && p <= 0x5F){
+		for(int II = 0; II < 8 && p - 0x20 + II < 0x40; II++) mux->reg[p - 0x20 + II] = (byte >> II) & 1;
+	}
+	SimElectrodeSwitches();
+	mux->pointer = (p + 1) & 0x7F;
+	return true;
+}
+uint8_t SimMax6956Read(void * state)
+{
+	struct sim_max6956 * mux = state;
+	uint8_t value = (mux->pointer < sizeof(mux->reg)) ? mux->reg[mux->pointer] : 0;
+	mux->pointer = (mux->pointer + 1) & 0x7F;
+	return value;
+}
+bool SimMuxPort(int mux, int port)
+{
+	// State of a port (4-31) of a multiplexer
+	return SimMultiplexer[mux].reg[0x20 + port] & 1;
+}
+
+// Temperature sensors: register pointer, then registers of 16 bits (MSB first)
+struct sim_sensor{
+	uint8_t pointer;
+	int index;
+	uint16_t reg[4];
+};
+struct sim_sensor SimMcp9801; // Registers: temperature, config, hysteresis, limit
+struct sim_sensor SimTmp006[3]; // Registers: sensor voltage, die temperature, config, (unused)
+
+bool SimSensorStart(void * state, bool read)
+{
+	struct sim_sensor * sensor = state;
+	sensor->index = read ? 2 : 0;
+	return true;
+}
+bool SimSensorWrite(void * state, uint8_t byte)
+{
+	struct sim_sensor * sensor = state;
+	if(sensor->index == 0) sensor->pointer = byte & 3;
+	else if(sensor->index == 1) sensor->reg[sensor->pointer] = byte << 8;
+	else sensor->reg[sensor->pointer] = (sensor->reg[sensor->pointer] & 0xFF00) | byte;
+	sensor->index++;
+	return true;
+}
+uint8_t SimSensorRead(void * state)
+{
+	struct sim_sensor * sensor = state;
+	uint16_t value = sensor->reg[sensor->pointer];
+	return (sensor->index++ & 1) ? value : value >> 8;
+}
+void SimSetTemperature(double celsius)
+{
+	// MCP9801: 1/256 C (9 to 12 bits used). TMP006 die temperature: 1/128 C (14 bits << 2)
+	SimMcp9801.reg[0] = (int16_t)(celsius*256) & 0xFF80;
+	for(int II = 0; II < 3; II++) SimTmp006[II].reg[1] = (int16_t)(celsius*32) << 2;
+}
+
+// Code EEPROM: address (2 bytes), then data (page write) or sequential read from the address
+struct sim_ext_eeprom{
+	uint8_t memory[SIM_EXT_EEPROM_SIZE];
+	uint8_t page[EXT_EEPROM_PAGE_SIZE];
+	bool written[EXT_EEPROM_PAGE_SIZE];
+	uint16_t address;
+	int index; // Bytes written in the transfer
+	uint64_t busy; // End of the write cycle
+	uint32_t cycles; // Number of write cycles
+};
+struct sim_ext_eeprom SimExtEeprom;
+
+bool SimExtEepromStart(void * state, bool read)
+{
+	struct sim_ext_eeprom * eeprom = state;
+	if(SimTime < eeprom->busy) return false; // No acknowledge during the write cycle
+	eeprom->index = 0;
+	memset(eeprom->written, 0, sizeof(eeprom->written));
+	return true;
+}
+bool SimExtEepromWrite(void * state, uint8_t byte)
+{
+	struct sim_ext_eeprom * eeprom = state;
+	if(eeprom->index == 0) eeprom->address = (byte << 8) % SIM_EXT_EEPROM_SIZE;
+	else if(eeprom->index == 1) eeprom->address |= byte;
+	else{
+		// Within the page: the address rolls over at the end of the page
+		int offset = eeprom->address % EXT_EEPROM_PAGE_SIZE;
+		eeprom->page[offset] = byte;
+		eeprom->written[offset] = true;
+		eeprom->address = (eeprom->address - offset) + (offset + 1) % EXT_EEPROM_PAGE_SIZE;
+	}
+	eeprom->index++;
+	return true;
+}
+uint8_t SimExtEepromRead(void * state)
+{
+	struct sim_ext_eeprom * eeprom = state;
+	uint8_t byte = eeprom->memory[eeprom->address];
+	eeprom->address = (eeprom->address + 1) % SIM_EXT_EEPROM_SIZE;
+	return byte;
+}
+void SimExtEepromStop(void * state)
+{
+	// Data received: write cycle of the page
+	struct sim_ext_eeprom * eeprom = state;
+	if(eeprom->index <= 2) return;
+	uint16_t base = eeprom->address - eeprom->address % EXT_EEPROM_PAGE_SIZE;
+	for(int II = 0; II < EXT_EEPROM_PAGE_SIZE; II++) if(eeprom->written[II]) eeprom->memory[base + II] = eeprom->page[II];
+	eeprom->busy = SimTime + SIM_EXT_EEPROM_WRITE_NS;
+	eeprom->cycles++;
+	eeprom->index = 0;
+}
+
+/*--------------------------------------------------
+                        ADC
+--------------------------------------------------*/
+uint16_t SimAdc[SIM_ADC_CHANNELS]; // Value of each channel (10 bits)
+
+void SimSetAdc(int channel, uint16_t value)
+{
+	SimAdc[channel] = value & 0x3FF;
+}
+uint16_t HAL_ADC_CONVERT(void)
+{
+	// 13 cycles of the ADC clock (F_CPU / 2^ADPS)
+	if(!(ADCSRA & (1<<ADEN))) return 0;
+	uint8_t adps = ADCSRA & 7;
+	SimAdvance(SimCycles(13ULL << (adps ? adps : 1)));
+	SimElectrodesUpdate();
+
+	uint16_t value = SimAdc[ADMUX & 7];
+	ADCL = value;
+	ADCH = value >> 8;
+	return value;
+}
+
+/*--------------------------------------------------
+                      PLANT
+--------------------------------------------------*/
+#include "Picomotor.h"
+#include "Electrodes.h"
+#include "XBee.h"
+
+/*--------------------------------------------------
+                      SIMULATOR
+--------------------------------------------------*/
+void SimInit(void)
+{
+	// Power on: erased EEPROMs, devices on the buses, then the initialization of the firmware
+	memset(SimEeprom, 0xFF, sizeof(SimEeprom));
+	memset(SimExtEeprom.memory, 0xFF, sizeof(SimExtEeprom.memory));
+
+	SimTwiCount = 0;
+	for(int II = 0; II < 2; II++) SimTwiAttach(MPaddr[II], &SimMultiplexer[II], SimMax6956Start, SimMax6956Write, SimMax6956Read, NULL);
+	SimTwiAttach(0x9E, &SimMcp9801, SimSensorStart, SimSensorWrite, SimSensorRead, NULL);
+	const uint8_t tmp006[3] = {0x80, 0x82, 0x88};
+	for(int II = 0; II < 3; II++) SimTwiAttach(tmp006[II], &SimTmp006[II], SimSensorStart, SimSensorWrite, SimSensorRead, NULL);
+	SimTwiAttach(EXT_EEPROM_ADDR[0], &SimExtEeprom, SimExtEepromStart, SimExtEepromWrite, SimExtEepromRead, SimExtEepromStop);
+	SimSetTemperature(20);
+
+	// Reset state of the devices. Separation device still holding the mirror
+	SimExpander.reg[SIM_IODIRA] = SimExpander.reg[SIM_IODIRB] = 0xFF;
+	SimPicomotorInit();
+	SimElectrodesInit();
+	SimXBeeInit();
+	TWSR = TW_NO_INFO;
+	SimSetPin(&PIN_SD_DET, SEP_DEV_DET, true);
+
+	SYSTEM_INIT();
+}
+bool SimFastForward = true; // Jump over the time the main loop has nothing to do
+
+uint64_t SimFirmwareWake(void)
+{
+	// Time until which a pass of the main loop (SystemUpdate in main.c) changes nothing, if no event happens
+	// SimTime = busy now. Keep in line with the tasks of the main loop.
+	uint64_t wake = SIM_NEVER;
+	
+	// Bytes received not read yet, or a message waiting (the partial messages are dropped after the timeout)
+	if((USART0_RX_HEAD != USART0_RX_TAIL) || USART0_RX_ERROR || (USART1_RX_HEAD != USART1_RX_TAIL) || USART1_RX_ERROR) return SimTime;
+	if(XBeeRxHead != XBeeRxTail) return SimTime;
+	for(int II = 0; II < 2; II++){
+		if(RxPort[II].state == RX_READY) return SimTime;
+		if(RxPort[II].state == RX_RECEIVING){
+			uint64_t timeout = SimTickTime(RxPort[II].last_tick + REGISTER[memory_COMMUNICATION_TIMEOUT] + 1);
+			if(timeout < wake) wake = timeout;
+		}
+	}
+	
+	// HV ramp: next step now, next feedback sample after HV_SLEW_MS
+	if(HVRampState == HV_RAMP_STEP) return SimTime;
+	if(HVRampState == HV_RAMP_SETTLE){
+		uint64_t sample = SimTickTime(HVRampSampleTick + REGISTER[memory_HV_SLEW_MS]);
+		if(sample < wake) wake = sample;
+	}
+	
+	// Error events written to the EEPROM after ERROR_FLUSH_MS
+	if(ErrorRamCount){
+		uint64_t flush = SimTickTime(ErrorRamTick + ERROR_FLUSH_MS);
+		if(flush < wake) wake = flush;
+	}
+	
+	return wake;
+}
+void SimRun(uint64_t ns)
+{
+	// Run the main loop of the firmware for a duration. In between two events, the idle passes are skipped
+	uint64_t end = SimTime + ns;
+	while(SimTime < end){
+		SystemUpdate();
+		
+		uint64_t next = SimFastForward ? SimFirmwareWake() : SimTime;
+		if(SimNextEvent() < next) next = SimNextEvent();
+		if(end < next) next = end;
+		if(next > SimTime) SimAdvance(next - SimTime);
+	}
+}
+
+#endif /* SIMULATOR_H_ */
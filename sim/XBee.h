@@ -0,0 +1,210 @@
+/*
+ * XBee.h
+ *
+ * Model of the XBee radio on USART1, included by Simulator.h.
+ * In transparent mode (api false, default) the radio is a byte pipe: the host reads and writes USART1 directly.
+ * In API mode (api true, AP = 2) it decodes the escaped frames sent by the firmware:
+ * - TX request (0x10): the payload is an RF packet to the ground (SimXBeeReceive), answered by a TX status
+ *   (0x8B) with the delivery status set by the host (0 = success) after SIM_XBEE_STATUS_NS.
+ * - AT command (0x08): BD, RO and AC are applied, answered by an AT response (0x88). BD is the index of a standard
+ *   rate (0-8) or a non-standard rate itself (0x80 to 0x1C9C380), in 1 to 4 bytes.
+ * The ground sends RF packets to the firmware with SimXBeeSend: they arrive as RX packets (0x90).
+ * Frames with a wrong checksum are counted and ignored, like the radio does.
+ */
+
+
+#ifndef XBEE_H_
+#define XBEE_H_
+
+/*--------------------------------------------------
+                     PARAMETERS
+--------------------------------------------------*/
+#define SIM_XBEE_STATUS_NS 5000000 // Time from the end of a TX request to its TX status [ns]
+#define SIM_XBEE_PACKETS 16 // RF packets to the ground kept for the host
+#define SIM_XBEE_FRAME_MAX 256 // Longest frame data
+
+/*--------------------------------------------------
+                      MODEL
+--------------------------------------------------*/
+struct sim_xbee_packet{
+	uint8_t dest[8]; // 64-bit destination address
+	uint8_t data[SIM_XBEE_FRAME_MAX];
+	int len;
+};
+
+struct sim_xbee{
+	// Configuration
+	bool api; // AP = 2
+	uint8_t address[8]; // 64-bit address of the ground station
+	uint8_t delivery; // Delivery status of the next TX status frames (0 = success)
+	uint32_t bd, bd_pending; // BD applied by AC, and set
+	uint8_t ro, ro_pending; // RO applied by AC, and set
+
+	// Frame being received from the firmware
+	uint8_t frame[SIM_XBEE_FRAME_MAX];
+	int len; // -3 = waiting for start, -2/-1 = length
+	int size;
+	bool escaped;
+	uint8_t at_response[5]; // Next AT response
+
+	// RF packets sent to the ground
+	struct sim_xbee_packet packets[SIM_XBEE_PACKETS];
+	uint32_t packet_head, packet_tail;
+
+	// Statistics
+	uint32_t tx_requests, tx_statuses, at_commands, checksum_errors;
+};
+struct sim_xbee SimXBee;
+
+void SimXBeeInit(void)
+{
+	memset(&SimXBee, 0, sizeof(SimXBee));
+	const uint8_t ground[8] = {0x00, 0x13, 0xA2, 0x00, 0x40, 0x8B, 0x5A, 0x01};
+	memcpy(SimXBee.address, ground, 8);
+	SimXBee.bd = SimXBee.bd_pending = 3; // 9600
+	SimXBee.ro = SimXBee.ro_pending = 3;
+	SimXBee.len = -3;
+}
+int SimXBeeEscape(uint8_t * out, uint8_t byte)
+{
+	if(byte == XBEE_START || byte == XBEE_ESCAPE || byte == XBEE_XON || byte == XBEE_XOFF){
+		out[0] = XBEE_ESCAPE;
+		out[1] = byte ^ 0x20;
+		return 2;
+	}
+	out[0] = byte;
+	return 1;
+}
+void SimXBeeFrame(const uint8_t * data, int len)
+{
+	// Send an API frame to the firmware
+	uint8_t bytes[2*SIM_XBEE_FRAME_MAX + 8];
+	int n = 0;
+	uint8_t sum = 0;
+	bytes[n++] = XBEE_START;
+	n += SimXBeeEscape(bytes + n, len >> 8);
+	n += SimXBeeEscape(bytes + n, len);
+	for(int II = 0; II < len; II++){
+		n += SimXBeeEscape(bytes + n, data[II]);
+		sum += data[II];
+	}
+	n += SimXBeeEscape(bytes + n, 0xFF - sum);
+	SimUsartSend(1, bytes, n);
+}
+void SimXBeeStatus(void * context)
+{
+	// TX status: frame id | 16-bit address (2) | retries | delivery | discovery
+	uint8_t frame_id = (uintptr_t)context;
+	uint8_t status[7] = {XBEE_TX_STATUS, frame_id, 0xFF, 0xFE, 0, SimXBee.delivery, 0};
+	SimXBee.tx_statuses++;
+	SimXBeeFrame(status, 7);
+}
+void SimXBeeAtResponse(void * context)
+{
+	SimXBeeFrame(SimXBee.at_response, 5);
+}
+void SimXBeeParse(uint64_t time)
+{
+	// Complete frame from the firmware (checksum checked)
+	uint8_t * frame = SimXBee.frame;
+	if(frame[0] == XBEE_TX_REQUEST && SimXBee.size >= 14){
+		// Frame id | destination (8) | 16-bit address (2) | radius | options | data
+		SimXBee.tx_requests++;
+		if(SimXBee.packet_head - SimXBee.packet_tail < SIM_XBEE_PACKETS){
+			struct sim_xbee_packet * packet = &SimXBee.packets[SimXBee.packet_head++ % SIM_XBEE_PACKETS];
+			memcpy(packet->dest, frame + 2, 8);
+			packet->len = SimXBee.size - 14;
+			memcpy(packet->data, frame + 14, packet->len);
+		}
+		if(frame[1]) SimSchedule(time + SIM_XBEE_STATUS_NS, SimXBeeStatus, (void *)(uintptr_t)frame[1]);
+	}
+	else if(frame[0] == XBEE_AT_COMMAND && SimXBee.size >= 4){
+		// Frame id | command (2) | parameter
+		SimXBee.at_commands++;
+		uint8_t status = 0;
+		if(frame[2] == 'B' && frame[3] == 'D'){
+			uint32_t bd = 0;
+			for(int II = 4; II < SimXBee.size; II++) bd = (bd << 8) | frame[II];
+			if(SimXBee.size >= 5 && SimXBee.size <= 8 && (bd <= 8 || (bd >= 0x80 && bd <= 0x1C9C380))) SimXBee.bd_pending = bd;
+			else status = 2; // Invalid parameter
+		}
+		else if(frame[2] == 'R' && frame[3] == 'O'){
+			if(SimXBee.size == 5) SimXBee.ro_pending = frame[4];
+			else status = 2;
+		}
+		else if(frame[2] == 'A' && frame[3] == 'C'){
+			SimXBee.bd = SimXBee.bd_pending;
+			SimXBee.ro = SimXBee.ro_pending;
+		}
+		else status = 1; // Error
+		// AT response: frame id | command (2) | status, once the command is received
+		uint8_t response[5] = {XBEE_AT_RESPONSE, frame[1], frame[2], frame[3], status};
+		memcpy(SimXBee.at_response, response, 5);
+		if(frame[1]) SimSchedule(time, SimXBeeAtResponse, NULL);
+	}
+}
+void SimXBeeTransmit(uint8_t byte, uint64_t time)
+{
+	// A byte sent by the firmware on USART1, ending at time
+	if(!SimXBee.api) return;
+
+	if(byte == XBEE_START){
+		SimXBee.len = -2;
+		SimXBee.escaped = false;
+		return;
+	}
+	if(SimXBee.len == -3) return;
+	if(byte == XBEE_ESCAPE){
+		SimXBee.escaped = true;
+		return;
+	}
+	if(SimXBee.escaped){
+		byte ^= 0x20;
+		SimXBee.escaped = false;
+	}
+
+	if(SimXBee.len == -2){
+		SimXBee.size = byte << 8;
+		SimXBee.len++;
+	}
+	else if(SimXBee.len == -1){
+		SimXBee.size |= byte;
+		SimXBee.len++;
+		if(SimXBee.size == 0 || SimXBee.size > SIM_XBEE_FRAME_MAX) SimXBee.len = -3;
+	}
+	else if(SimXBee.len < SimXBee.size){
+		SimXBee.frame[SimXBee.len++] = byte;
+	}
+	else{
+		uint8_t sum = byte;
+		for(int II = 0; II < SimXBee.size; II++) sum += SimXBee.frame[II];
+		if(sum == 0xFF) SimXBeeParse(time);
+		else SimXBee.checksum_errors++;
+		SimXBee.len = -3;
+	}
+}
+void SimXBeeSend(const uint8_t * data, int len)
+{
+	// RF packet from the ground: RX packet (0x90) = source (8) | 16-bit source (2) | options | data
+	uint8_t frame[SIM_XBEE_FRAME_MAX];
+	if(len > SIM_XBEE_FRAME_MAX - 12) len = SIM_XBEE_FRAME_MAX - 12;
+	frame[0] = XBEE_RX_PACKET;
+	memcpy(frame + 1, SimXBee.address, 8);
+	frame[9] = 0xFF;
+	frame[10] = 0xFE;
+	frame[11] = 0x01; // Acknowledged
+	memcpy(frame + 12, data, len);
+	SimXBeeFrame(frame, len + 12);
+}
+int SimXBeeReceive(uint8_t * dest, uint8_t * data, int max_len)
+{
+	// Next RF packet sent to the ground (length, -1 if none). dest may be NULL
+	if(SimXBee.packet_tail == SimXBee.packet_head) return -1;
+	struct sim_xbee_packet * packet = &SimXBee.packets[SimXBee.packet_tail++ % SIM_XBEE_PACKETS];
+	if(dest) memcpy(dest, packet->dest, 8);
+	int len = (packet->len < max_len) ? packet->len : max_len;
+	memcpy(data, packet->data, len);
+	return len;
+}
+
+#endif /* XBEE_H_ */
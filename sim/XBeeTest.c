@@ -0,0 +1,93 @@
+/*
+ * XBeeTest.c
+ *
+ * Test of the XBee API mode against the radio model (XBee.h):
+ * - command 158 on USART0 switches the firmware to API mode, command 159 sets RO with AT commands;
+ * - a PING sent from the ground in an RF packet is answered in one TX request to the ground address,
+ *   whose TX status is handled (delivered, then failed: memory_XBEE_TX_FAILS);
+ * - command 158 changes the baud rate: BD is the index of a standard rate, or the rate itself (4 bytes) for the
+ *   others (250000, 500000, 76800). A PING from the ground is answered at each rate.
+ * Prints one "name value" per line, then "xbee_test ok" or the failed checks. Exits with 1 on failure.
+ */
+
+
+#include "Simulator.h"
+#include "Check.h"
+#include <stdio.h>
+
+int32_t Command(uint8_t command, int32_t data)
+{
+	// Legacy message on USART0, returns the data of the feedback (-1 if none)
+	uint8_t message[MessageN] = {command, data >> 24, data >> 16, data >> 8, data};
+	uint8_t reply[MessageN];
+	SimUsartSend(0, message, MessageN);
+	SimRun(100000000);
+	if(SimUsartReceive(0, reply, MessageN) != MessageN || reply[0] != command) return -1;
+	return ((int32_t)reply[1] << 24) | ((int32_t)reply[2] << 16) | ((int32_t)reply[3] << 8) | reply[4];
+}
+void Ping(int32_t data, const char * name)
+{
+	// PING from the ground in an RF packet, answered in one RF packet to the ground
+	uint8_t message[MessageN] = {255, data >> 24, data >> 16, data >> 8, data};
+	uint8_t reply[64], dest[8];
+	char label[64];
+	SimXBeeSend(message, MessageN);
+	SimRun(200000000);
+
+	int len = SimXBeeReceive(dest, reply, sizeof(reply));
+	snprintf(label, sizeof(label), "%s_packet_len", name);
+	Check(label, len, MessageN);
+	snprintf(label, sizeof(label), "%s_reply_matches", name);
+	Check(label, len == MessageN && !memcmp(reply, message, MessageN), 1);
+	snprintf(label, sizeof(label), "%s_dest_is_ground", name);
+	Check(label, !memcmp(dest, SimXBee.address, 8), 1);
+}
+
+int main(void)
+{
+	SimInit();
+	SimXBee.api = true; // Radio configured with AP = 2
+
+	// API mode at 9600 baud (USART1 already at 9600: no AT command), then RO with AT commands (RO, AC)
+	Check("api_status", Command(158, 9600 | (1L << XBEE_API_BIT)), OK);
+	Check("api_register", REGISTER[memory_XBEE_API], 1);
+	Check("ro_status", Command(159, 5), OK);
+	Check("radio_ro", SimXBee.ro, 5);
+	Check("at_commands", SimXBee.at_commands, 2);
+
+	// TX request and TX status round trip, delivered
+	Ping(0x1234, "ping");
+	Check("tx_requests", SimXBee.tx_requests, 1);
+	Check("tx_statuses", SimXBee.tx_statuses, 1);
+	Check("tx_fails", REGISTER[memory_XBEE_TX_FAILS], 0);
+
+	// Delivery failed (no acknowledgement): counted by the firmware
+	SimXBee.delivery = 0x21;
+	Ping(0x5678, "ping_failed");
+	Check("tx_statuses_failed", SimXBee.tx_statuses, 2);
+	Check("tx_fails_failed", REGISTER[memory_XBEE_TX_FAILS], 1);
+	SimXBee.delivery = 0;
+
+	// Baud rates: standard (BD index) and non-standard (BD = rate)
+	const unsigned long bauds[4] = {19200, 250000, 500000, 76800};
+	const uint32_t bds[4] = {4, 250000, 500000, 76800};
+	for(int II = 0; II < 4; II++){
+		char label[64];
+		snprintf(label, sizeof(label), "baud_%lu_status", bauds[II]);
+		Check(label, Command(158, bauds[II] | (1L << XBEE_API_BIT)), OK);
+		snprintf(label, sizeof(label), "baud_%lu_bd", bauds[II]);
+		Check(label, SimXBee.bd, bds[II]);
+		snprintf(label, sizeof(label), "baud_%lu_usart1", bauds[II]);
+		Check(label, REGISTER[memory_USART1_BAUD], bauds[II]);
+		snprintf(label, sizeof(label), "baud_%lu", bauds[II]);
+		Ping(0x1000 + II, label);
+	}
+	Check("baud_oob_status", Command(158, 100 | (1L << XBEE_API_BIT)), XBEE_BAUD_OOB);
+
+	Check("checksum_errors", SimXBee.checksum_errors, 0);
+	Check("rx_errors", REGISTER[memory_XBEE_RX_ERRORS], 0);
+
+	printf(Failures ? "xbee_test FAILED (%d)\n" : "xbee_test ok\n", Failures);
+	fflush(NULL); // stdout is the stream of the firmware here (SimHal.h)
+	return Failures ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * eeprom.h (simulator)
+ *
+ * Internal EEPROM of the ATmega1284P (4 KB). The addresses are offsets in the simulated memory.
+ * A byte written costs the programming time of the real part.
+ */
+
+
+#ifndef SIM_AVR_EEPROM_H_
+#define SIM_AVR_EEPROM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EEMEM
+#define E2END 4095
+
+uint8_t eeprom_read_byte(const uint8_t * addr);
+uint16_t eeprom_read_word(const uint16_t * addr);
+uint32_t eeprom_read_dword(const uint32_t * addr);
+void eeprom_read_block(void * dst, const void * src, size_t n);
+
+void eeprom_write_byte(uint8_t * addr, uint8_t value);
+void eeprom_write_word(uint16_t * addr, uint16_t value);
+void eeprom_write_dword(uint32_t * addr, uint32_t value);
+void eeprom_write_block(const void * src, void * dst, size_t n);
+
+void eeprom_update_byte(uint8_t * addr, uint8_t value);
+void eeprom_update_word(uint16_t * addr, uint16_t value);
+void eeprom_update_dword(uint32_t * addr, uint32_t value);
+void eeprom_update_block(const void * src, void * dst, size_t n);
+
+#endif /* SIM_AVR_EEPROM_H_ */
@@ -0,0 +1,21 @@
+/*
+ * interrupt.h (simulator)
+ *
+ * An interrupt routine is a plain function, called by the simulator when its event happens
+ * and the global interrupt flag (bit 7 of SREG) is set.
+ */
+
+
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector, ...) void vector(void)
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+
+#define sei() (SREG |= (1<<7))
+#define cli() (SREG &= ~(1<<7))
+
+#endif /* SIM_AVR_INTERRUPT_H_ */
@@ -0,0 +1,99 @@
+/*
+ * io.h (simulator)
+ *
+ * Registers and bits of the ATmega1284P used by the firmware. On the host they are plain variables,
+ * defined in sim/Simulator.h and read/written by the peripheral models.
+ */
+
+
+#ifndef SIM_AVR_IO_H_
+#define SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+/*--------------------------------------------------
+                     REGISTERS
+--------------------------------------------------*/
+#define SIM_REGISTER(name) extern volatile uint8_t name;
+
+// Status register (bit 7 = global interrupt enable)
+SIM_REGISTER(SREG)
+
+// GPIO
+SIM_REGISTER(DDRA) SIM_REGISTER(PORTA) SIM_REGISTER(PINA)
+SIM_REGISTER(DDRB) SIM_REGISTER(PORTB) SIM_REGISTER(PINB)
+SIM_REGISTER(DDRC) SIM_REGISTER(PORTC) SIM_REGISTER(PINC)
+SIM_REGISTER(DDRD) SIM_REGISTER(PORTD) SIM_REGISTER(PIND)
+
+// USART
+SIM_REGISTER(UDR0) SIM_REGISTER(UCSR0A) SIM_REGISTER(UCSR0B) SIM_REGISTER(UCSR0C) SIM_REGISTER(UBRR0H) SIM_REGISTER(UBRR0L)
+SIM_REGISTER(UDR1) SIM_REGISTER(UCSR1A) SIM_REGISTER(UCSR1B) SIM_REGISTER(UCSR1C) SIM_REGISTER(UBRR1H) SIM_REGISTER(UBRR1L)
+
+// SPI
+SIM_REGISTER(SPCR) SIM_REGISTER(SPSR) SIM_REGISTER(SPDR)
+
+// TWI
+SIM_REGISTER(TWBR) SIM_REGISTER(TWCR) SIM_REGISTER(TWSR) SIM_REGISTER(TWDR)
+
+// ADC
+SIM_REGISTER(ADMUX) SIM_REGISTER(ADCSRA) SIM_REGISTER(ADCL) SIM_REGISTER(ADCH) SIM_REGISTER(DIDR0)
+
+// Watchdog
+SIM_REGISTER(WDTCSR)
+
+// Timers
+SIM_REGISTER(TCCR0A) SIM_REGISTER(TCCR0B) SIM_REGISTER(TCNT0) SIM_REGISTER(OCR0A) SIM_REGISTER(TIMSK0) SIM_REGISTER(TIFR0)
+SIM_REGISTER(TCCR1A) SIM_REGISTER(TCCR1B) SIM_REGISTER(TIMSK1) SIM_REGISTER(TIFR1)
+extern volatile uint16_t TCNT1;
+
+/*--------------------------------------------------
+                       BITS
+--------------------------------------------------*/
+// USART
+enum {MPCM0, U2X0, UPE0, DOR0, FE0, UDRE0, TXC0, RXC0};
+enum {TXB80, RXB80, UCSZ02, TXEN0, RXEN0, UDRIE0, TXCIE0, RXCIE0};
+enum {UCPOL0, UCSZ00, UCSZ01, USBS0, UPM00, UPM01, UMSEL00, UMSEL01};
+enum {MPCM1, U2X1, UPE1, DOR1, FE1, UDRE1, TXC1, RXC1};
+enum {TXB81, RXB81, UCSZ12, TXEN1, RXEN1, UDRIE1, TXCIE1, RXCIE1};
+enum {UCPOL1, UCSZ10, UCSZ11, USBS1, UPM10, UPM11, UMSEL10, UMSEL11};
+
+// SPI
+enum {SPR0, SPR1, CPHA, CPOL, MSTR, DORD, SPE, SPIE};
+enum {SPI2X, WCOL = 6, SPIF};
+
+// TWI
+enum {TWIE, TWEN = 2, TWWC, TWSTO, TWSTA, TWEA, TWINT};
+enum {TWPS0, TWPS1};
+
+// ADC
+enum {ADPS0, ADPS1, ADPS2, ADIE, ADIF, ADATE, ADSC, ADEN};
+enum {MUX0, MUX1, MUX2, MUX3, MUX4, ADLAR, REFS0, REFS1};
+
+// Watchdog
+enum {WDP0, WDP1, WDP2, WDE, WDCE, WDP3, WDIE, WDIF};
+
+// Timer 0
+enum {WGM00, WGM01, COM0B0 = 4, COM0B1, COM0A0, COM0A1};
+enum {CS00, CS01, CS02, WGM02, FOC0B = 6, FOC0A};
+enum {TOIE0, OCIE0A, OCIE0B};
+enum {TOV0, OCF0A, OCF0B};
+
+// Timer 1
+enum {WGM10, WGM11, COM1B0 = 4, COM1B1, COM1A0, COM1A1};
+enum {CS10, CS11, CS12, WGM12, WGM13, ICES1 = 6, ICNC1};
+enum {TOIE1, OCIE1A, OCIE1B, ICIE1 = 5};
+enum {TOV1, OCF1A, OCF1B, ICF1 = 5};
+
+// GPIO
+enum {PORTA0, PORTA1, PORTA2, PORTA3, PORTA4, PORTA5, PORTA6, PORTA7};
+enum {PORTB0, PORTB1, PORTB2, PORTB3, PORTB4, PORTB5, PORTB6, PORTB7};
+enum {PORTC0, PORTC1, PORTC2, PORTC3, PORTC4, PORTC5, PORTC6, PORTC7};
+enum {PORTD0, PORTD1, PORTD2, PORTD3, PORTD4, PORTD5, PORTD6, PORTD7};
+enum {PINA0, PINA1, PINA2, PINA3, PINA4, PINA5, PINA6, PINA7};
+enum {PINB0, PINB1, PINB2, PINB3, PINB4, PINB5, PINB6, PINB7};
+enum {PINC0, PINC1, PINC2, PINC3, PINC4, PINC5, PINC6, PINC7};
+enum {PIND0, PIND1, PIND2, PIND3, PIND4, PIND5, PIND6, PIND7};
+
+#endif /* SIM_AVR_IO_H_ */
@@ -0,0 +1,20 @@
+/*
+ * pgmspace.h (simulator)
+ *
+ * The host has a single address space: constants in the flash are ordinary constants.
+ */
+
+
+#ifndef SIM_AVR_PGMSPACE_H_
+#define SIM_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define memcpy_P memcpy
+
+#endif /* SIM_AVR_PGMSPACE_H_ */
@@ -0,0 +1,17 @@
+/*
+ * wdt.h (simulator)
+ *
+ * The watchdog is modelled by the simulator (WDT_vect after the timeout set in WDTCSR).
+ */
+
+
+#ifndef SIM_AVR_WDT_H_
+#define SIM_AVR_WDT_H_
+
+void SimWatchdogReset(void);
+void SimWatchdogDisable(void);
+
+#define wdt_reset() SimWatchdogReset()
+#define wdt_disable() SimWatchdogDisable()
+
+#endif /* SIM_AVR_WDT_H_ */
@@ -0,0 +1,14 @@
+/*
+ * delay.h (simulator)
+ *
+ * A delay lets the virtual time run: it costs no wall time.
+ */
+
+
+#ifndef SIM_UTIL_DELAY_H_
+#define SIM_UTIL_DELAY_H_
+
+void _delay_ms(double ms);
+void _delay_us(double us);
+
+#endif /* SIM_UTIL_DELAY_H_ */
@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""
+stack_report.py
+
+Worst-case stack depth of the firmware, from the call graph written by gcc -fcallgraph-info=su,da (.ci files).
+
+Each function costs the stack usage given by gcc. On AVR it includes the saved registers and the return address.
+The depth of an entry point is the largest sum of the costs along its calls. The entry points are main and the
+interrupts (__vector_N, named after the ATmega1284P vectors). The interrupts use the stack of the code they
+interrupt. The worst case of the whole firmware is therefore main, plus the interrupts that can be interrupted
+themselves (--nested, ISR_NOBLOCK), plus the deepest of the other interrupts.
+
+The following are errors, because their depth is unknown:
+- recursion, unless a function calls itself directly and the number of its nested calls is given (--recursion);
+- a variable-length array without a bound (--dynamic);
+- a call to a function that is not in the call graph (library, indirect call) without a cost (--extern).
+
+Usage: stack_report.py [--budget BYTES] [--nested ISR]... [--dynamic FUNCTION=BYTES]... [--recursion FUNCTION=CALLS]...
+                       [--extern FUNCTION=BYTES]... [--extern-default BYTES] [--static BYTES --ram BYTES] file.ci...
+Exits with 1 when there is an error or when the worst case is over the budget (or over the RAM left by the static data).
+"""
+
+import argparse
+import re
+import sys
+
+# ATmega1284P interrupt vectors (avr/iom1284p.h)
+VECTORS = ["RESET", "INT0", "INT1", "INT2", "PCINT0", "PCINT1", "PCINT2", "PCINT3", "WDT", "TIMER2_COMPA",
+	"TIMER2_COMPB", "TIMER2_OVF", "TIMER1_CAPT", "TIMER1_COMPA", "TIMER1_COMPB", "TIMER1_OVF", "TIMER0_COMPA",
+	"TIMER0_COMPB", "TIMER0_OVF", "SPI_STC", "USART0_RX", "USART0_UDRE", "USART0_TX", "ANALOG_COMP", "ADC",
+	"EE_READY", "TWI", "SPM_READY", "USART1_RX", "USART1_UDRE", "USART1_TX", "TIMER3_CAPT", "TIMER3_COMPA",
+	"TIMER3_COMPB", "TIMER3_OVF"]
+
+NODE = re.compile(r'^node: \{ title: "([^"]*)" label: "([^"]*)"')
+EDGE = re.compile(r'^edge: \{ sourcename: "([^"]*)" targetname: "([^"]*)"')
+USAGE = re.compile(r'\\n(\d+) bytes \(([a-z,]+)\)')
+
+
+def display(name):
+	# Interrupts by their vector name, local copies (file:function.part.0) by their function
+	match = re.fullmatch(r'__vector_(\d+)', name)
+	if match and int(match.group(1)) < len(VECTORS):
+		return VECTORS[int(match.group(1))] + "_vect"
+	return name.split(":")[-1]
+
+
+def sizes(values):
+	# FUNCTION=BYTES options
+	table = {}
+	for value in values:
+		name, _, size = value.partition("=")
+		table[name] = int(size)
+	return table
+
+
+def load(files):
+	# Stack usage of each function (None: not compiled here) and its callees
+	usage, calls = {}, {}
+	for path in files:
+		with open(path) as ci:
+			for line in ci:
+				node = NODE.match(line)
+				if node:
+					title, label = node.groups()
+					found = USAGE.search(label)
+					if found or title not in usage:
+						usage[title] = (int(found.group(1)), found.group(2)) if found else None
+					calls.setdefault(title, [])
+					continue
+				edge = EDGE.match(line)
+				if edge:
+					calls.setdefault(edge.group(1), []).append(edge.group(2))
+	return usage, calls
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Worst-case stack depth from gcc call graphs (.ci)")
+	parser.add_argument("files", nargs="+")
+	parser.add_argument("--budget", type=int, help="Largest worst case allowed [bytes]")
+	parser.add_argument("--nested", action="append", default=[], help="Interrupt that other interrupts can interrupt")
+	parser.add_argument("--dynamic", action="append", default=[], help="FUNCTION=BYTES: bound of its variable-length arrays")
+	parser.add_argument("--recursion", action="append", default=[], help="FUNCTION=CALLS: times it can be on the stack")
+	parser.add_argument("--extern", action="append", default=[], help="FUNCTION=BYTES: cost of a function not in the call graph")
+	parser.add_argument("--extern-default", type=int, help="Cost of the other functions not in the call graph")
+	parser.add_argument("--static", type=int, help="Static RAM (.data, .bss, .noinit) [bytes]")
+	parser.add_argument("--ram", type=int, help="RAM size [bytes]")
+	args = parser.parse_args()
+
+	usage, calls = load(args.files)
+	dynamic, extern, recursion = sizes(args.dynamic), sizes(args.extern), sizes(args.recursion)
+	errors, defaulted = [], set()
+
+	def cost(name):
+		if usage.get(name) is None:
+			short = display(name)
+			if short in extern:
+				return extern[short]
+			if args.extern_default is None:
+				errors.append("%s: not in the call graph, no cost given (--extern)" % short)
+				return 0
+			defaulted.add(short)
+			return args.extern_default
+		size, kind = usage[name]
+		if kind == "dynamic":
+			short = display(name)
+			if short not in dynamic:
+				errors.append("%s: variable-length array without a bound (--dynamic)" % short)
+				return size
+			return size + dynamic[short]
+		return size
+
+	# Deepest path from each function (depth first, recursion is an error)
+	depth, path, active, repeated = {}, {}, [], {}
+
+	def visit(name):
+		if name in depth:
+			return depth[name]
+		if name in active:
+			cycle = active[active.index(name):] + [name]
+			errors.append("recursion: " + " > ".join(display(n) for n in cycle))
+			return 0
+		active.append(name)
+		best, best_path = 0, []
+		recursive = False
+		for callee in calls.get(name, []):
+			if callee == name and display(name) in recursion:
+				recursive = True
+				continue
+			size = visit(callee)
+			if size > best or not best_path:
+				best, best_path = size, [callee] + path.get(callee, [])
+		active.pop()
+		# Bounded recursion: the outer calls keep their frame, the innermost one goes deepest
+		repeated[name] = recursion[display(name)] if recursive else 1
+		depth[name] = cost(name)*repeated[name] + best
+		path[name] = best_path
+		return depth[name]
+
+	isrs = sorted((n for n in usage if usage[n] is not None and
+		(re.fullmatch(r'__vector_\d+', n) or n.endswith("_vect"))), key=display)
+	entries = (["main"] if "main" in usage else []) + isrs
+	if "main" not in usage:
+		errors.append("main: not in the call graph")
+
+	def frame(name):
+		if repeated.get(name, 1) > 1:
+			return "%s (%d x%d)" % (display(name), cost(name), repeated[name])
+		return "%s (%d)" % (display(name), cost(name))
+
+	print("%-20s %6s  %s" % ("entry point", "bytes", "worst path"))
+	for entry in entries:
+		visit(entry)
+		chain = [entry] + path[entry]
+		print("%-20s %6d  %s" % (display(entry), depth[entry], " > ".join(frame(n) for n in chain)))
+
+	# main, interrupted by the nested interrupts, themselves interrupted by the deepest other interrupt
+	nested = [n for n in isrs if display(n) in args.nested]
+	others = [n for n in isrs if n not in nested]
+	for name in args.nested:
+		if name not in [display(n) for n in nested]:
+			errors.append("%s: nested interrupt not in the call graph" % name)
+	parts = [("main", depth.get("main", 0))] + [(display(n) + " (nested)", depth[n]) for n in nested]
+	if others:
+		deepest = max(others, key=lambda n: depth[n])
+		parts.append((display(deepest), depth[deepest]))
+	total = sum(size for _, size in parts)
+	print()
+	print("worst case: %s = %d bytes" % (" + ".join("%s %d" % part for part in parts), total))
+
+	failed = False
+	if defaulted:
+		print("default cost (%d bytes) for: %s" % (args.extern_default, ", ".join(sorted(defaulted))))
+	if args.budget is not None:
+		over = total > args.budget
+		print("budget %d bytes: %s (%+d)" % (args.budget, "OVER" if over else "OK", args.budget - total))
+		failed |= over
+	if args.static is not None and args.ram is not None:
+		over = args.static + total > args.ram
+		print("ram: static %d + stack %d = %d of %d bytes: %s" % (args.static, total, args.static + total, args.ram,
+			"OVER" if over else "OK"))
+		failed |= over
+	for error in sorted(set(errors)):
+		print("error: " + error, file=sys.stderr)
+	return 1 if failed or errors else 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())